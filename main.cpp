@@ -27,14 +27,56 @@
 #include <syscmdline/command.h>
 #include <syscmdline/parser.h>
 #include <clang-c/Index.h>
+#include <clang-c/CXCompilationDatabase.h>
+#ifdef WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  ifdef __linux__
+#    include <sys/inotify.h>
+#    include <poll.h>
+#  endif
+#endif
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <numeric>
 #include <clocale>
 #include <ctime>
 #include <iomanip>
+#include <utility>
+#include <charconv>
+#include <filesystem>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <array>
+#include <map>
+#include <type_traits>
+#include <chrono>
+#include <bit>
 
 namespace std
 {
@@ -74,12 +116,14 @@ struct Function
     std::string resultType = {};
     std::stringlist parameters = {};
     std::string callingConvention = {};
+    bool variadic = false;
 
     [[nodiscard]] inline bool empty() const {
         return name.empty();
     }
 
     inline void clear() {
+        variadic = false;
         name.clear();
         name.shrink_to_fit();
         resultType.clear();
@@ -96,6 +140,7 @@ struct Header
 {
     std::string filename = {};
     Functions functions = {};
+    std::stringlist dependencies = {}; // Every file libclang read for this header, including itself.
 
     [[nodiscard]] inline bool empty() const {
         return filename.empty();
@@ -106,6 +151,8 @@ struct Header
         filename.shrink_to_fit();
         functions.clear();
         functions.shrink_to_fit();
+        dependencies.clear();
+        dependencies.shrink_to_fit();
     }
 };
 using Headers = std::vector<Header>;
@@ -140,6 +187,16 @@ using Headers = std::vector<Header>;
     return type.ends_with('&');
 }
 
+template<typename T>
+[[nodiscard]] static inline bool toUnsigned(const std::string_view str, T &valueOut)
+{
+    if (str.empty()) {
+        return false;
+    }
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), valueOut);
+    return (ec == std::errc{}) && (ptr == (str.data() + str.size()));
+}
+
 [[nodiscard]] static inline std::string fromNativeSeparators(const std::string_view path)
 {
     std::string result(path);
@@ -158,6 +215,13 @@ using Headers = std::vector<Header>;
     return result;
 }
 
+[[nodiscard]] static inline std::string toAbsolutePath(const std::string_view path)
+{
+    std::error_code ec = {};
+    const std::filesystem::path absolutePath = std::filesystem::absolute(path, ec);
+    return ec ? std::string(path) : absolutePath.lexically_normal().string();
+}
+
 [[nodiscard]] static inline std::string extractFileName(const std::string_view path)
 {
     std::string result = fromNativeSeparators(path);
@@ -186,40 +250,726 @@ using Headers = std::vector<Header>;
     return fileName;
 }
 
-[[nodiscard]] static inline bool parseTranslationUnit(const std::string_view path, Functions &functionsOut)
+using IndexPtr = std::unique_ptr<void, decltype(&::clang_disposeIndex)>;
+using TranslationUnitPtr = std::unique_ptr<CXTranslationUnitImpl, decltype(&::clang_disposeTranslationUnit)>;
+
+[[nodiscard]] static inline IndexPtr createIndex()
+{
+    CXIndexOptions indexOptions = {};
+    indexOptions.Size = sizeof(CXIndexOptions);
+    // We are a batch tool, there is no UI thread to keep responsive, but we don't want to
+    // starve the other jobs of the build which runs us either.
+    indexOptions.ThreadBackgroundPriorityForIndexing = CXChoice_Enabled;
+    indexOptions.ThreadBackgroundPriorityForEditing = CXChoice_Enabled;
+    indexOptions.ExcludeDeclarationsFromPCH = 0;
+    indexOptions.DisplayDiagnostics = 0;
+    CXIndex index = ::clang_createIndexWithOptions(&indexOptions);
+    if (!index) {
+        // Older libclang doesn't know about the options struct.
+        index = ::clang_createIndex(0, 0);
+    }
+    return IndexPtr(index, &::clang_disposeIndex);
+}
+
+// Returns the peak resident set size of the current process, in bytes.
+[[nodiscard]] static inline std::uint64_t getPeakMemoryUsage()
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof(counters);
+    if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage = {};
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#  ifdef __APPLE__
+    return std::uint64_t(usage.ru_maxrss);
+#  else
+    return std::uint64_t(usage.ru_maxrss) * 1024;
+#  endif
+#endif
+}
+
+struct MemoryGuard
+{
+    bool enabled = false;
+    std::uint64_t limit = 0; // In MiB, 0 means no limit.
+
+    [[nodiscard]] inline bool exceeded() const {
+        return enabled && (limit > 0) && (getPeakMemoryUsage() > (limit * 1024 * 1024));
+    }
+
+    [[nodiscard]] inline bool check(const std::string_view phase) const {
+        if (!enabled) {
+            return true;
+        }
+        const std::uint64_t peak = getPeakMemoryUsage() / 1024 / 1024;
+        std::cout << "Peak memory usage after the " << phase << " phase: " << peak << " MiB" << std::endl;
+        if ((limit > 0) && (peak > limit)) {
+            std::cerr << "The peak memory usage exceeded the limit (" << limit << " MiB)." << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// FNV-1a, it's good enough to tell different inputs apart and we don't want any dependency for it.
+[[nodiscard]] static inline std::uint64_t hashBytes(const void *data, const std::size_t size, std::uint64_t seed = 14695981039346656037ull)
+{
+    const auto bytes = static_cast<const unsigned char *>(data);
+    for (std::size_t index = 0; index != size; ++index) {
+        seed ^= bytes[index];
+        seed *= 1099511628211ull;
+    }
+    return seed;
+}
+
+[[nodiscard]] static inline std::uint64_t hashString(const std::string_view str, const std::uint64_t seed = 14695981039346656037ull)
+{
+    // Also hash the length, so that ("ab", "c") and ("a", "bc") don't collide when chained.
+    const std::uint64_t size = str.size();
+    return hashBytes(str.data(), str.size(), hashBytes(&size, sizeof(size), seed));
+}
+
+// The symbol hash of the GNU hash tables of ELF files (DJB2).
+[[nodiscard]] static inline constexpr std::uint32_t gnuHash(const std::string_view name)
+{
+    std::uint32_t hash = 5381;
+    for (auto &&ch : name) {
+        hash = (hash * 33) + std::uint8_t(ch);
+    }
+    return hash;
+}
+
+// A read-only view of a whole file, mapped into memory.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path &path) {
+#ifdef WIN32
+        m_file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER fileSize = {};
+        if (!::GetFileSizeEx(m_file, &fileSize) || (fileSize.QuadPart <= 0)) {
+            return;
+        }
+        m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) {
+            return;
+        }
+        m_data = ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_data) {
+            m_size = std::size_t(fileSize.QuadPart);
+        }
+#else
+        m_file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_file < 0) {
+            return;
+        }
+        struct stat fileInfo = {};
+        if ((::fstat(m_file, &fileInfo) != 0) || (fileInfo.st_size <= 0)) {
+            return;
+        }
+        void *data = ::mmap(nullptr, std::size_t(fileInfo.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+        if (data != MAP_FAILED) {
+            m_data = data;
+            m_size = std::size_t(fileInfo.st_size);
+        }
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef WIN32
+        if (m_data) {
+            ::UnmapViewOfFile(m_data);
+        }
+        if (m_mapping) {
+            ::CloseHandle(m_mapping);
+        }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            ::CloseHandle(m_file);
+        }
+#else
+        if (m_data) {
+            ::munmap(m_data, m_size);
+        }
+        if (m_file >= 0) {
+            ::close(m_file);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    [[nodiscard]] inline bool isValid() const {
+        return m_data != nullptr;
+    }
+
+    [[nodiscard]] inline const char *data() const {
+        return static_cast<const char *>(m_data);
+    }
+
+    [[nodiscard]] inline std::size_t size() const {
+        return m_size;
+    }
+
+private:
+#ifdef WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+    void *m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// Writes the file next to its final location first and then renames it, so that
+// the readers (even those from the other processes) never see a partial file.
+[[nodiscard]] static inline bool writeFileAtomically(const std::filesystem::path &path, const std::string_view content)
+{
+    static thread_local std::mt19937_64 generator(std::random_device{}());
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp" + std::to_string(generator());
+    {
+        std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+        out.write(content.data(), std::streamsize(content.size()));
+        out.close();
+        if (!out) {
+            std::error_code ec = {};
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+    std::error_code ec = {};
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
+
+// Tells whether a file has changed without reading it, just like make does. A file which doesn't exist
+// has the size "-1", which no existing file has.
+struct FileStamp
+{
+    std::uint64_t size = 0;
+    std::int64_t modificationTime = 0;
+
+    [[nodiscard]] inline bool operator==(const FileStamp &) const = default;
+};
+
+[[nodiscard]] static inline FileStamp getFileStamp(const std::string &path)
+{
+    std::error_code ec = {};
+    FileStamp stamp = {};
+    stamp.size = std::filesystem::file_size(path, ec);
+    stamp.modificationTime = std::int64_t(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    return stamp;
+}
+
+// Maps (header content, libclang version, parse options) to the functions we extracted from that header.
+// Every entry is a flat file which is read through a memory mapping:
+//   u32 magic, u32 format version, u64 key, u32 function count, then for every function:
+//   string name, string result type, string calling convention, u8 variadic, u32 parameter count, string parameters...
+// followed by u32 dependency count, then for every dependency: string path, u64 size, i64 modification time,
+// and every string is a u32 length followed by the characters (no terminator). All integers are in the
+// native byte order, entries written by a machine of a different byte order are rejected by the magic.
+// The key only covers the header itself, an entry is also a miss if any of the files it includes changed since.
+class FunctionCache
+{
+public:
+    static constexpr std::uint32_t kMagic = 0x43475744; // "DWGC"
+    static constexpr std::uint32_t kFormatVersion = 5;
+
+    explicit FunctionCache(const std::filesystem::path &directory) : m_directory(directory) {
+        const CXString versionStr = ::clang_getClangVersion();
+        m_salt = hashString(::clang_getCString(versionStr));
+        ::clang_disposeString(versionStr);
+        m_salt = hashBytes(&kFormatVersion, sizeof(kFormatVersion), m_salt);
+    }
+
+    [[nodiscard]] inline bool initialize() const {
+        std::error_code ec = {};
+        std::filesystem::create_directories(m_directory, ec);
+        if (ec) {
+            std::cerr << "Failed to create the cache directory:" << m_directory.string() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] inline std::uint64_t key(const std::string_view content, const std::uint32_t parseOptions, const std::uint64_t context = 0) const {
+        return hashBytes(&context, sizeof(context), hashBytes(&parseOptions, sizeof(parseOptions), hashString(content, m_salt)));
+    }
+
+    [[nodiscard]] inline bool load(const std::uint64_t key, Functions &functionsOut, std::stringlist &dependenciesOut) const {
+        const MappedFile file(entryPath(key));
+        if (!file.isValid()) {
+            return false;
+        }
+        const char *cursor = file.data();
+        const char *const end = file.data() + file.size();
+        const auto readInt = [&cursor, end]<typename T>(T &valueOut) -> bool {
+            if (std::size_t(end - cursor) < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&valueOut, cursor, sizeof(T));
+            cursor += sizeof(T);
+            return true;
+        };
+        const auto readString = [&cursor, end, &readInt](std::string &strOut) -> bool {
+            std::uint32_t length = 0;
+            if (!readInt(length) || (std::size_t(end - cursor) < length)) {
+                return false;
+            }
+            strOut.assign(cursor, length);
+            cursor += length;
+            return true;
+        };
+        std::uint32_t magic = 0;
+        std::uint32_t formatVersion = 0;
+        std::uint64_t storedKey = 0;
+        std::uint32_t functionCount = 0;
+        if (!readInt(magic) || (magic != kMagic) || !readInt(formatVersion) || (formatVersion != kFormatVersion)
+            || !readInt(storedKey) || (storedKey != key) || !readInt(functionCount)) {
+            return false;
+        }
+        Functions functions(functionCount);
+        for (auto &&function : functions) {
+            std::uint8_t variadic = 0;
+            std::uint32_t parameterCount = 0;
+            if (!readString(function.name) || !readString(function.resultType) || !readString(function.callingConvention) || !readInt(variadic) || !readInt(parameterCount)) {
+                return false;
+            }
+            function.variadic = (variadic != 0);
+            function.parameters.resize(parameterCount);
+            for (auto &&parameter : function.parameters) {
+                if (!readString(parameter)) {
+                    return false;
+                }
+            }
+        }
+        std::uint32_t dependencyCount = 0;
+        if (!readInt(dependencyCount)) {
+            return false;
+        }
+        std::stringlist dependencies(dependencyCount);
+        for (auto &&dependency : dependencies) {
+            FileStamp stamp = {};
+            if (!readString(dependency) || !readInt(stamp.size) || !readInt(stamp.modificationTime) || (getFileStamp(dependency) != stamp)) {
+                return false;
+            }
+        }
+        functionsOut = std::move(functions);
+        dependenciesOut = std::move(dependencies);
+        return true;
+    }
+
+    [[nodiscard]] inline bool store(const std::uint64_t key, const Functions &functions, const std::stringlist &dependencies) const {
+        std::string buffer = {};
+        const auto writeInt = [&buffer]<typename T>(const T value) {
+            buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        };
+        const auto writeString = [&buffer, &writeInt](const std::string_view str) {
+            writeInt(std::uint32_t(str.size()));
+            buffer.append(str);
+        };
+        writeInt(kMagic);
+        writeInt(kFormatVersion);
+        writeInt(key);
+        writeInt(std::uint32_t(functions.size()));
+        for (auto &&function : std::as_const(functions)) {
+            writeString(function.name);
+            writeString(function.resultType);
+            writeString(function.callingConvention);
+            writeInt(std::uint8_t(function.variadic ? 1 : 0));
+            writeInt(std::uint32_t(function.parameters.size()));
+            for (auto &&parameter : std::as_const(function.parameters)) {
+                writeString(parameter);
+            }
+        }
+        writeInt(std::uint32_t(dependencies.size()));
+        for (auto &&dependency : std::as_const(dependencies)) {
+            const FileStamp stamp = getFileStamp(dependency);
+            writeString(dependency);
+            writeInt(stamp.size);
+            writeInt(stamp.modificationTime);
+        }
+        return writeFileAtomically(entryPath(key), buffer);
+    }
+
+    // The other kinds of cached files (such as the precompiled headers) live next to the entries.
+    [[nodiscard]] inline std::filesystem::path entryPath(const std::uint64_t key, const std::string_view extension = ".dwgc") const {
+        char name[17] = {};
+        std::to_chars(name, name + 16, key, 16);
+        std::string fileName(16 - std::strlen(name), '0');
+        fileName += name;
+        fileName += extension;
+        return m_directory / fileName;
+    }
+
+private:
+    std::filesystem::path m_directory = {};
+    std::uint64_t m_salt = 0;
+};
+
+// The command line a header is parsed with, it's converted only once and shared by all the parse jobs.
+struct CompileFlags
+{
+    std::stringlist arguments = {};
+    std::vector<const char *> argv = {}; // Points into "arguments", so the flags must not be copied or moved once it's built.
+    std::uint64_t hash = 0;
+    bool fromDatabase = false; // Only the real flags of a header let us follow its includes.
+
+    inline void finalize() {
+        argv.reserve(arguments.size());
+        for (auto &&argument : std::as_const(arguments)) {
+            argv.push_back(argument.c_str());
+            hash = hashString(argument, hash);
+        }
+    }
+};
+
+// A compilation database (compile_commands.json), it gives us the include paths and the
+// defines of the headers, so that the declarations behind the macros are not missed.
+class CompilationDatabase
+{
+public:
+    explicit CompilationDatabase(const std::filesystem::path &directory) {
+        CXCompilationDatabase_Error error = CXCompilationDatabase_NoError;
+        m_database = ::clang_CompilationDatabase_fromDirectory(directory.string().c_str(), &error);
+        if (error != CXCompilationDatabase_NoError) {
+            m_database = nullptr;
+        }
+    }
+
+    ~CompilationDatabase() {
+        if (m_database) {
+            ::clang_CompilationDatabase_dispose(m_database);
+        }
+    }
+
+    CompilationDatabase(const CompilationDatabase &) = delete;
+    CompilationDatabase &operator=(const CompilationDatabase &) = delete;
+
+    [[nodiscard]] inline bool isValid() const {
+        return m_database != nullptr;
+    }
+
+    // Takes the first command of the file, without the compiler, the input file, the output options and the
+    // dependency file options (the parse must not write any file), everything else is passed to libclang as is,
+    // the relative paths are resolved against the directory of the command.
+    [[nodiscard]] inline bool findFlags(const std::filesystem::path &path, CompileFlags &flagsOut) const {
+        const CXCompileCommands commands = ::clang_CompilationDatabase_getCompileCommands(m_database, path.string().c_str());
+        if (!commands) {
+            return false;
+        }
+        if (::clang_CompileCommands_getSize(commands) == 0) {
+            ::clang_CompileCommands_dispose(commands);
+            return false;
+        }
+        const CXCompileCommand command = ::clang_CompileCommands_getCommand(commands, 0);
+        const std::string directory = toString(::clang_CompileCommand_getDirectory(command));
+        const std::filesystem::path fileName = std::filesystem::path(directory) / toString(::clang_CompileCommand_getFilename(command));
+        const unsigned argumentCount = ::clang_CompileCommand_getNumArgs(command);
+        std::stringlist arguments = {};
+        for (unsigned index = 1; index < argumentCount; ++index) {
+            std::string argument = toString(::clang_CompileCommand_getArg(command, index));
+            if ((argument == "-c") || (argument == "--") || isDependencyFlag(argument)) {
+                continue;
+            }
+            if (const std::string_view option = findOutputOption(argument); !option.empty()) {
+                // Separated ("-o file") or joined ("-ofile").
+                if (argument.size() == option.size()) {
+                    ++index;
+                }
+                continue;
+            }
+            if (!argument.starts_with('-') && ((std::filesystem::path(directory) / argument).lexically_normal() == fileName.lexically_normal())) {
+                continue;
+            }
+            arguments.push_back(std::move(argument));
+        }
+        ::clang_CompileCommands_dispose(commands);
+        arguments.push_back("-working-directory");
+        arguments.push_back(directory);
+        flagsOut.arguments = std::move(arguments);
+        flagsOut.fromDatabase = true;
+        return true;
+    }
+
+private:
+    [[nodiscard]] static inline bool isDependencyFlag(const std::string_view argument) {
+        return (argument == "-M") || (argument == "-MM") || (argument == "-MD") || (argument == "-MMD") || (argument == "-MP") || (argument == "-MG");
+    }
+
+    // Returns the option if the argument is one of the options which take a file or a target name, empty otherwise.
+    [[nodiscard]] static inline std::string_view findOutputOption(const std::string_view argument) {
+        for (const std::string_view option : { "-MF", "-MT", "-MQ", "-MJ" }) {
+            if (argument.starts_with(option)) {
+                return option;
+            }
+        }
+        // Not "-objcmt-..." or "-object".
+        if (argument.starts_with("-o") && !argument.starts_with("-obj")) {
+            return "-o";
+        }
+        return {};
+    }
+
+    [[nodiscard]] static inline std::string toString(const CXString str) {
+        std::string result = ::clang_getCString(str);
+        ::clang_disposeString(str);
+        return result;
+    }
+
+    CXCompilationDatabase m_database = nullptr;
+};
+
+// Lends the indexes of a long running process to its parse jobs, so that they are only created once.
+// An index is never used by two jobs at the same time.
+class IndexPool
+{
+public:
+    [[nodiscard]] inline IndexPtr acquire() {
+        {
+            const std::scoped_lock locker(m_mutex);
+            if (!m_indexes.empty()) {
+                IndexPtr index = std::move(m_indexes.back());
+                m_indexes.pop_back();
+                return index;
+            }
+        }
+        return createIndex();
+    }
+
+    inline void release(IndexPtr index) {
+        if (!index) {
+            return;
+        }
+        const std::scoped_lock locker(m_mutex);
+        m_indexes.push_back(std::move(index));
+    }
+
+private:
+    std::mutex m_mutex = {};
+    std::vector<IndexPtr> m_indexes = {};
+};
+
+// The headers parsed by the requests of a long running process, shared by all its later (and concurrent)
+// requests. Only the first request which needs a header parses it, the others wait for its result. Just
+// like the function cache, the key is the content of the header, an entry is replaced once any of the
+// files it includes changed. Once there are too many, the least recently used entries are dropped.
+class SharedHeaderCache
+{
+public:
+    using Parser = std::function<bool(Functions &, std::stringlist &)>;
+
+    [[nodiscard]] inline bool findOrParse(const std::string &path, const std::uint32_t parseOptions, const std::uint64_t context, const Parser &parse, Functions &functionsOut, std::stringlist &dependenciesOut) {
+        std::uint64_t key = 0;
+        {
+            const MappedFile content(path);
+            if (!content.isValid()) {
+                std::cerr << "Failed to read the header file:" << path << std::endl;
+                return false;
+            }
+            key = hashBytes(&context, sizeof(context), hashBytes(&parseOptions, sizeof(parseOptions), hashString(std::string_view(content.data(), content.size()))));
+        }
+        std::shared_ptr<Entry> entry = {};
+        while (true) {
+            bool owner = false;
+            {
+                const std::scoped_lock locker(m_mutex);
+                std::shared_ptr<Entry> &slot = m_entries[key];
+                if (!slot) {
+                    slot = std::make_shared<Entry>();
+                    owner = true;
+                }
+                slot->lastUsed = ++m_clock;
+                entry = slot;
+                if (owner) {
+                    evict();
+                }
+            }
+            if (owner) {
+                Functions functions = {};
+                std::stringlist dependencies = {};
+                const bool succeeded = parse(functions, dependencies);
+                std::vector<FileStamp> stamps = {};
+                for (auto &&dependency : std::as_const(dependencies)) {
+                    stamps.push_back(getFileStamp(dependency));
+                }
+                {
+                    const std::scoped_lock locker(m_mutex);
+                    entry->functions = std::move(functions);
+                    entry->dependencies = std::move(dependencies);
+                    entry->stamps = std::move(stamps);
+                    entry->succeeded = succeeded;
+                    entry->done = true;
+                    // Let the next request try again.
+                    if (!succeeded) {
+                        m_entries.erase(key);
+                    }
+                }
+                m_condition.notify_all();
+                break;
+            }
+            {
+                std::unique_lock locker(m_mutex);
+                m_condition.wait(locker, [&entry]() -> bool { return entry->done; });
+            }
+            // Only the later requests parse a header again if it failed, not the ones which waited for it.
+            if (!entry->succeeded) {
+                break;
+            }
+            if (isUpToDate(*entry)) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            // Drop the stale entry (unless another request already did) and parse the header again.
+            const std::scoped_lock locker(m_mutex);
+            const auto it = m_entries.find(key);
+            if ((it != m_entries.cend()) && (it->second == entry)) {
+                m_entries.erase(it);
+            }
+        }
+        // The entry is never touched again once it's done.
+        if (!entry->succeeded) {
+            m_failures.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        functionsOut = entry->functions;
+        dependenciesOut = entry->dependencies;
+        return true;
+    }
+
+    [[nodiscard]] inline std::size_t hits() const {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] inline std::size_t failures() const {
+        return m_failures.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr std::size_t kMaxEntries = 256;
+
+    struct Entry
+    {
+        bool done = false;
+        bool succeeded = false;
+        std::uint64_t lastUsed = 0; // The value of m_clock when a request last looked it up.
+        Functions functions = {};
+        std::stringlist dependencies = {};
+        std::vector<FileStamp> stamps = {}; // Of the dependencies, when they were parsed.
+    };
+
+    [[nodiscard]] static inline bool isUpToDate(const Entry &entry) {
+        for (std::size_t index = 0; index != entry.dependencies.size(); ++index) {
+            if (getFileStamp(entry.dependencies[index]) != entry.stamps[index]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Drops the least recently used entries which are done (the requests still using them keep their own reference)
+    // until there are at most kMaxEntries left, the lock must be held.
+    inline void evict() {
+        while (m_entries.size() > kMaxEntries) {
+            auto oldest = m_entries.end();
+            for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+                if (it->second->done && ((oldest == m_entries.end()) || (it->second->lastUsed < oldest->second->lastUsed))) {
+                    oldest = it;
+                }
+            }
+            if (oldest == m_entries.end()) {
+                return;
+            }
+            m_entries.erase(oldest);
+        }
+    }
+
+    std::mutex m_mutex = {};
+    std::condition_variable m_condition = {};
+    std::map<std::uint64_t, std::shared_ptr<Entry>> m_entries = {};
+    std::uint64_t m_clock = 0;
+    std::atomic_size_t m_hits = 0;
+    std::atomic_size_t m_failures = 0;
+};
+
+struct ParseOptions
+{
+    std::size_t threadCount = 1;
+    MemoryGuard memoryGuard = {};
+    std::filesystem::path cacheDirectory = {};
+    bool umbrella = false;
+    std::filesystem::path compilationDatabase = {}; // The directory which contains compile_commands.json.
+    std::string compileCommandsEntry = {}; // The entry to take the flags from if a header doesn't have its own.
+    std::string prefixHeader = {}; // Precompiled once and included before every header.
+    // Both are only set by the server, they live as long as it does.
+    IndexPool *indexPool = nullptr;
+    SharedHeaderCache *sharedCache = nullptr;
+};
+
+using FileId = std::array<unsigned long long, 3>;
+
+struct ParseState
+{
+    std::vector<Functions> functions = {}; // One list for every header.
+    std::vector<std::stringlist> dependencies = {}; // Same.
+    Function function = {};
+    std::size_t functionHeader = 0;
+    // Tells which header a declaration comes from, the declarations of the other files are ignored.
+    // Not needed if the includes are skipped and there's only one header.
+    const std::map<FileId, std::size_t> *headerIndexes = nullptr;
+    bool umbrella = false; // The main file is the generated umbrella source, which includes the headers.
+
+    inline void commitFunction() {
+        if (function.empty()) {
+            return;
+        }
+        functions[functionHeader].push_back(std::move(function));
+        function.clear();
+    }
+};
+
+[[nodiscard]] static inline std::uint32_t getTranslationUnitFlags(const bool singleFile = true)
 {
-    const CXIndex index = ::clang_createIndex(0, 0);
     std::uint32_t options = CXTranslationUnit_None;
     options |= CXTranslationUnit_Incomplete;
     options |= CXTranslationUnit_CacheCompletionResults;
     options |= CXTranslationUnit_SkipFunctionBodies;
     options |= CXTranslationUnit_KeepGoing;
-    options |= CXTranslationUnit_SingleFileParse;
+    if (singleFile) {
+        options |= CXTranslationUnit_SingleFileParse;
+    }
     options |= CXTranslationUnit_IgnoreNonErrorsFromIncludedFiles;
     options |= CXTranslationUnit_RetainExcludedConditionalBlocks;
-    const CXTranslationUnit unit = ::clang_parseTranslationUnit(index, path.data(), nullptr, 0, nullptr, 0, options);
-
-    if (!unit) {
-        std::cerr << "libclang failed to parse the translation unit:" << path << std::endl;
-        return false;
-    }
-
-    //static std::string fileName = {};
-    static Functions functions = {};
-    static Function function = {};
-    static bool insideParameterList = false;
-
-    // They are static variables after all, we need to ensure they are all expected initial value.
-    //fileName = extractFileName(path);
-    functions.clear();
-    function.clear();
-    insideParameterList = false;
+    return options;
+}
 
+[[nodiscard]] static inline bool visitTranslationUnit(const CXTranslationUnit unit, ParseState &state)
+{
+    // The visitor callback can't capture anything, all the state it needs is passed
+    // through the client data, so that multiple headers can be parsed concurrently.
     const CXCursor cursor = ::clang_getTranslationUnitCursor(unit);
     const uint32_t parseResult = ::clang_visitChildren(cursor,
         [](CXCursor currentCursor, CXCursor parentCursor, CXClientData clientData) -> CXChildVisitResult {
             static_cast<void>(parentCursor);
-            static_cast<void>(clientData);
+            auto &parseState = *static_cast<ParseState *>(clientData);
             switch (::clang_getCursorKind(currentCursor)) {
             case CXCursor_FunctionDecl: {
                 const CXLinkageKind linkage = ::clang_getCursorLinkage(currentCursor);
@@ -243,156 +993,3722 @@ using Headers = std::vector<Header>;
                 if (functionName.starts_with('_')) {
                     return CXChildVisit_Continue;
                 }
-//                const CXSourceRange sourceRange = ::clang_getCursorExtent(currentCursor);
-//                const CXSourceLocation sourceLocation = ::clang_getRangeStart(sourceRange);
-//                CXFile sourceFile = nullptr;
-//                ::clang_getExpansionLocation(sourceLocation, &sourceFile, nullptr, nullptr, nullptr);
-//                const CXString sourceFileNameStr = ::clang_getFileName(sourceFile);
-//                const std::string sourceFileName = extractFileName(::clang_getCString(sourceFileNameStr));
-//                ::clang_disposeString(sourceFileNameStr);
-//                if (sourceFileName != fileName) {
-//                    return CXChildVisit_Continue;
-//                }
-                if (insideParameterList) {
-                    insideParameterList = false;
-                    functions.push_back(function);
-                    function.clear();
-                }
-                function.name = functionName;
+                std::size_t headerIndex = 0;
+                if (parseState.headerIndexes) {
+                    // Attribute the declaration to the header it's spelled in (after macro expansion),
+                    // anything which comes from the other included files is not our business.
+                    const CXSourceLocation sourceLocation = ::clang_getCursorLocation(currentCursor);
+                    CXFile sourceFile = nullptr;
+                    ::clang_getExpansionLocation(sourceLocation, &sourceFile, nullptr, nullptr, nullptr);
+                    CXFileUniqueID sourceFileId = {};
+                    if (!sourceFile || (::clang_getFileUniqueID(sourceFile, &sourceFileId) != 0)) {
+                        return CXChildVisit_Continue;
+                    }
+                    const auto it = parseState.headerIndexes->find(std::to_array(sourceFileId.data));
+                    if (it == parseState.headerIndexes->cend()) {
+                        return CXChildVisit_Continue;
+                    }
+                    headerIndex = it->second;
+                }
+                parseState.commitFunction();
+                parseState.functionHeader = headerIndex;
+                parseState.function.name = functionName;
                 const CXType functionType = ::clang_getCursorType(currentCursor);
                 const CXType resultType = ::clang_getCursorResultType(currentCursor);
                 const CXString resultStr = ::clang_getTypeSpelling(resultType);
-                function.resultType = ::clang_getCString(resultStr);
+                parseState.function.resultType = ::clang_getCString(resultStr);
                 ::clang_disposeString(resultStr);
                 const CXCallingConv callingConvention = ::clang_getFunctionTypeCallingConv(functionType);
-                function.callingConvention = std::to_string(callingConvention);
+                parseState.function.callingConvention = std::to_string(callingConvention);
+                parseState.function.variadic = (::clang_isFunctionTypeVariadic(functionType) != 0);
 //                ::CXString prettyStr = ::clang_getCursorPrettyPrinted(currentCursor, nullptr);
 //                std::cout << "Pretty: " << ::clang_getCString(prettyStr) << std::endl;
 //                ::clang_disposeString(prettyStr);
                 return CXChildVisit_Recurse;
             }
             case CXCursor_ParmDecl: {
-                insideParameterList = true;
                 const CXType parameterType = ::clang_getCursorType(currentCursor);
                 const CXString parameterStr = ::clang_getTypeSpelling(parameterType);
-                function.parameters.push_back(::clang_getCString(parameterStr));
+                parseState.function.parameters.push_back(::clang_getCString(parameterStr));
                 ::clang_disposeString(parameterStr);
-                return CXChildVisit_Recurse;
+                // Don't step into the parameters of a function pointer parameter, they are not ours.
+                return CXChildVisit_Continue;
             }
             default:
                 return CXChildVisit_Continue;
             }
-        }, nullptr);
+        }, &state);
     if (parseResult != 0) {
         std::cerr << "The parsing process was terminated prematurely." << std::endl;
         return false;
     }
-
-    functionsOut = functions;
+    state.commitFunction();
     return true;
 }
 
-[[nodiscard]] static inline bool generateWrapper(const std::string_view filePath, const std::string_view dllFileName, const bool sysDirOnly, const Headers &headers)
+// Prefers the real path, the name libclang was given may be relative to the working directory of the compile command.
+[[nodiscard]] static inline std::string getFileName(const CXFile file)
 {
-    if (filePath.empty() || dllFileName.empty() || headers.empty()) {
-        std::cerr << "generateWrapper: invalid parameter" << std::endl;
-        return false;
-    }
-    std::ofstream out(std::string(filePath), std::ios::out | std::ios::trunc);
-    if (!out.is_open()) {
-        std::cerr << "generateWrapper: failed to open file to write:" << filePath << std::endl;
-        return false;
-    }
-    const std::time_t now = std::time(nullptr);
-    out << "// GENERATED BY DLL WRAPPER GENERATOR ON " << std::put_time(std::localtime(&now), "%F %T %z") << std::endl;
-    out << "#ifndef __EMSCRIPTEN__" << std::endl;
-    out << "#ifdef WIN32" << std::endl;
-    out << "#  include <windows.h>" << std::endl;
-    out << "#  define DWG_API __stdcall" << std::endl;
-    out << "#else" << std::endl;
-    out << "#  include <dlfcn.h>" << std::endl;
-    out << "#  define DWG_API" << std::endl;
-    out << "#endif" << std::endl;
-    out << "#include <string>" << std::endl;
-    out << "using DWG_LibraryHandle = void *;" << std::endl;
-    out << "using DWG_FunctionPointer = void(DWG_API *)();" << std::endl;
-    out << "#ifdef WIN32" << std::endl;
-    out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_LoadLibrary(const std::string_view path) { return ::LoadLibrary";
-    if (sysDirOnly) {
-        out << "ExA(path.data(), nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32";
-    } else {
-        out << "A(path.data()";
-    }
-    out << "); }" << std::endl;
-    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_GetProcAddress(const DWG_LibraryHandle library, const std::string_view name) { return reinterpret_cast<DWG_FunctionPointer>(::GetProcAddress(static_cast<HMODULE>(library), name.data())); }" << std::endl;
-    out << "static inline void DWG_API DWG_FreeLibrary(const DWG_LibraryHandle library) { ::FreeLibrary(static_cast<HMODULE>(library)); }" << std::endl;
-    out << "#else" << std::endl;
-    out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_LoadLibrary(const std::string_view path) { return ::dlopen(path.data(), RTLD_LAZY); }" << std::endl;
-    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_GetProcAddress(const DWG_LibraryHandle library, const std::string_view name) { reinterpret_cast<DWG_FunctionPointer>(::dlsym(library, name.data())); }" << std::endl;
-    out << "static inline void DWG_API DWG_FreeLibrary(const DWG_LibraryHandle library) { ::dlclose(library); }" << std::endl;
-    out << "#endif" << std::endl;
-    out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_TryGetLibrary() {" << std::endl;
-    out << "    static const auto library = ::DWG_LoadLibrary(" << std::endl;
-    out << "#ifdef WIN32" << std::endl;
-    out << "        \"" << dllFileName << ".dll\"" << std::endl;
-    out << "#elif defined(__APPLE__)" << std::endl;
-    out << "        \"lib" << dllFileName << ".dylib\"" << std::endl;
-    out << "#else" << std::endl;
-    out << "        \"lib" << dllFileName << ".so\"" << std::endl;
-    out << "#endif" << std::endl;
-    out << "        );" << std::endl;
-    out << "    return library;" << std::endl;
-    out << '}' << std::endl;
-    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_TryGetSymbol(const std::string_view name) { if (const auto library = ::DWG_TryGetLibrary()) { return ::DWG_GetProcAddress(library, name); } else { return nullptr; } }" << std::endl;
-    std::size_t totalFunctionCount = 0;
-    for (auto &&header : std::as_const(headers)) {
-        out << "#include <" << header.filename << '>' << std::endl;
-        totalFunctionCount += header.functions.size();
+    const CXString realPathStr = ::clang_File_tryGetRealPathName(file);
+    std::string fileName = ::clang_getCString(realPathStr);
+    ::clang_disposeString(realPathStr);
+    if (!fileName.empty()) {
+        return fileName;
     }
-    for (auto &&header : std::as_const(headers)) {
-        for (auto &&function : std::as_const(header.functions)) {
-            out << "extern \"C\" " << function.resultType;
-            if (!(isPointerType(function.resultType) || isReferenceType(function.resultType))) {
-                out << ' ';
-            }
-            out << function.callingConvention << ' ' << function.name << '(';
-            std::size_t parameterIndex = 1;
-            for (auto &&parameter : std::as_const(function.parameters)) {
-                out << parameter;
-                if (!(isPointerType(parameter) || isReferenceType(parameter))) {
-                    out << ' ';
+    const CXString fileNameStr = ::clang_getFileName(file);
+    fileName = ::clang_getCString(fileNameStr);
+    ::clang_disposeString(fileNameStr);
+    return fileName;
+}
+
+// Records every file the translation unit has read, so that the build system knows when to run us again.
+static inline void collectInclusions(const CXTranslationUnit unit, ParseState &state)
+{
+    ::clang_getInclusions(unit,
+        [](CXFile includedFile, CXSourceLocation *inclusionStack, unsigned includeLength, CXClientData clientData) {
+            auto &parseState = *static_cast<ParseState *>(clientData);
+            std::size_t headerIndex = 0;
+            if (parseState.umbrella) {
+                // The main file is the umbrella source, which doesn't exist on the disk. Everything else
+                // belongs to the header the umbrella source includes, which is the second last entry of
+                // the inclusion stack (or the file itself if it's one of the headers).
+                if (includeLength == 0) {
+                    return;
                 }
-                out << "arg" << parameterIndex;
-                if (parameterIndex < function.parameters.size()) {
-                    ++parameterIndex;
-                    out << ", ";
+                CXFile headerFile = includedFile;
+                if (includeLength > 1) {
+                    ::clang_getExpansionLocation(inclusionStack[includeLength - 2], &headerFile, nullptr, nullptr, nullptr);
                 }
-            }
-            out << ") {" << std::endl;
-            out << "    static const auto function = reinterpret_cast<decltype(&::" << function.name << ")>(::DWG_TryGetSymbol(\"" << function.name << "\"));" << std::endl;
-            std::string functionCallStr = "function(";
-            for (std::size_t index = 0; index != function.parameters.size(); ++index) {
-                functionCallStr += "arg" + std::to_string(index + 1);
-                if (index < function.parameters.size() - 1) {
-                    functionCallStr += ", ";
+                CXFileUniqueID headerFileId = {};
+                if (!headerFile || (::clang_getFileUniqueID(headerFile, &headerFileId) != 0)) {
+                    return;
                 }
+                const auto it = parseState.headerIndexes->find(std::to_array(headerFileId.data));
+                if (it == parseState.headerIndexes->cend()) {
+                    return;
+                }
+                headerIndex = it->second;
+            }
+            parseState.dependencies[headerIndex].push_back(getFileName(includedFile));
+        }, &state);
+}
+
+// With the real flags of the header we can follow its includes, the macros it relies on
+// are defined there. The flags change the working directory, the path must be absolute then.
+[[nodiscard]] static inline std::string getSourcePath(const std::string &path, const CompileFlags *flags)
+{
+    return (flags && flags->fromDatabase) ? toAbsolutePath(path) : path;
+}
+
+[[nodiscard]] static inline TranslationUnitPtr createTranslationUnit(const CXIndex index, const std::string &path, const CompileFlags *flags, const std::uint32_t extraOptions = 0)
+{
+    const std::uint32_t options = getTranslationUnitFlags(!(flags && flags->fromDatabase)) | extraOptions;
+    const std::string sourcePath = getSourcePath(path, flags);
+    const char *const *arguments = flags ? flags->argv.data() : nullptr;
+    const int argumentCount = flags ? int(flags->argv.size()) : 0;
+    TranslationUnitPtr unit(::clang_parseTranslationUnit(index, sourcePath.c_str(), arguments, argumentCount, nullptr, 0, options), &::clang_disposeTranslationUnit);
+    if (!unit) {
+        std::cerr << "libclang failed to parse the translation unit:" << path << std::endl;
+    }
+    return unit;
+}
+
+// Extracts the functions and the dependencies of the header a translation unit was created for.
+[[nodiscard]] static inline bool extractTranslationUnit(const CXTranslationUnit unit, const std::string &path, const CompileFlags *flags, Functions &functionsOut, std::stringlist &dependenciesOut)
+{
+    ParseState state = {};
+    state.functions.resize(1);
+    state.dependencies.resize(1);
+    std::map<FileId, std::size_t> headerIndexes = {};
+    if (flags && flags->fromDatabase) {
+        const CXFile file = ::clang_getFile(unit, getSourcePath(path, flags).c_str());
+        CXFileUniqueID fileId = {};
+        if (!file || (::clang_getFileUniqueID(file, &fileId) != 0)) {
+            std::cerr << "libclang failed to find the header in its own translation unit:" << path << std::endl;
+            return false;
+        }
+        headerIndexes.emplace(std::to_array(fileId.data), 0);
+        state.headerIndexes = &headerIndexes;
+    }
+    if (!visitTranslationUnit(unit, state)) {
+        return false;
+    }
+    collectInclusions(unit, state);
+
+    functionsOut = std::move(state.functions.front());
+    dependenciesOut = std::move(state.dependencies.front());
+    return true;
+}
+
+[[nodiscard]] static inline bool parseTranslationUnit(const CXIndex index, const std::string &path, const CompileFlags *flags, Functions &functionsOut, std::stringlist &dependenciesOut)
+{
+    // Dispose the translation unit as soon as we have extracted what we need, otherwise
+    // the memory usage grows with every header we parse.
+    const TranslationUnitPtr unit = createTranslationUnit(index, path, flags);
+    if (!unit) {
+        return false;
+    }
+    return extractTranslationUnit(unit.get(), path, flags, functionsOut, dependenciesOut);
+}
+
+// Parses all the headers at once, through a generated source file which includes every one of them,
+// so that the includes they have in common are only parsed once.
+[[nodiscard]] static inline bool parseUmbrellaTranslationUnit(const CXIndex index, const std::stringlist &paths, const CompileFlags *flags, std::vector<Functions> &functionsOut, std::vector<std::stringlist> &dependenciesOut)
+{
+    static constexpr const char kUmbrellaFileName[] = "dwg_umbrella.h";
+    std::stringlist absolutePaths = {};
+    absolutePaths.reserve(paths.size());
+    std::string umbrella = {};
+    for (auto &&path : std::as_const(paths)) {
+        absolutePaths.push_back(toAbsolutePath(path));
+        umbrella += "#include \"" + fromNativeSeparators(absolutePaths.back()) + "\"\n";
+    }
+    CXUnsavedFile unsavedFile = {};
+    unsavedFile.Filename = kUmbrellaFileName;
+    unsavedFile.Contents = umbrella.c_str();
+    unsavedFile.Length = static_cast<unsigned long>(umbrella.size());
+    // The headers are included by the umbrella source, we can't skip the includes this time.
+    const std::uint32_t options = getTranslationUnitFlags(false);
+    const char *const *arguments = flags ? flags->argv.data() : nullptr;
+    const int argumentCount = flags ? int(flags->argv.size()) : 0;
+    const TranslationUnitPtr unit(::clang_parseTranslationUnit(index, kUmbrellaFileName, arguments, argumentCount, &unsavedFile, 1, options), &::clang_disposeTranslationUnit);
+
+    if (!unit) {
+        std::cerr << "libclang failed to parse the umbrella translation unit." << std::endl;
+        return false;
+    }
+
+    std::map<FileId, std::size_t> headerIndexes = {};
+    for (std::size_t headerIndex = 0; headerIndex != paths.size(); ++headerIndex) {
+        const CXFile file = ::clang_getFile(unit.get(), absolutePaths[headerIndex].c_str());
+        CXFileUniqueID fileId = {};
+        if (!file || (::clang_getFileUniqueID(file, &fileId) != 0)) {
+            std::cerr << "libclang failed to find the header in the umbrella translation unit:" << paths[headerIndex] << std::endl;
+            return false;
+        }
+        // The same header may be given twice, the first one wins, just like the include guard would do.
+        headerIndexes.emplace(std::to_array(fileId.data), headerIndex);
+    }
+
+    ParseState state = {};
+    state.functions.resize(paths.size());
+    state.dependencies.resize(paths.size());
+    state.headerIndexes = &headerIndexes;
+    state.umbrella = true;
+    if (!visitTranslationUnit(unit.get(), state)) {
+        return false;
+    }
+    collectInclusions(unit.get(), state);
+
+    functionsOut = std::move(state.functions);
+    dependenciesOut = std::move(state.dependencies);
+    return true;
+}
+
+// Runs "job" once for every index in "order" on "threadCount" threads, the job also receives
+// the index of the worker which runs it. Every worker owns a queue which is dealt from the
+// front of "order" in a round-robin way, so the expensive jobs (which are expected to come
+// first) are started as early as possible. A worker which has drained its own queue steals
+// from the back of the others, where the cheap jobs are.
+static inline void runJobs(const std::vector<std::size_t> &order, const std::size_t threadCount, const std::function<void(const std::size_t, const std::size_t)> &job)
+{
+    if (order.empty()) {
+        return;
+    }
+    const std::size_t workerCount = std::clamp(threadCount, std::size_t(1), order.size());
+    if (workerCount == 1) {
+        for (auto &&index : std::as_const(order)) {
+            job(0, index);
+        }
+        return;
+    }
+    struct WorkQueue
+    {
+        std::mutex mutex = {};
+        std::deque<std::size_t> jobs = {};
+    };
+    std::vector<WorkQueue> queues(workerCount);
+    for (std::size_t index = 0; index != order.size(); ++index) {
+        queues[index % workerCount].jobs.push_back(order[index]);
+    }
+    const auto takeJob = [&queues, workerCount](const std::size_t worker, std::size_t &jobOut) -> bool {
+        {
+            WorkQueue &own = queues[worker];
+            const std::scoped_lock locker(own.mutex);
+            if (!own.jobs.empty()) {
+                jobOut = own.jobs.front();
+                own.jobs.pop_front();
+                return true;
+            }
+        }
+        for (std::size_t offset = 1; offset != workerCount; ++offset) {
+            WorkQueue &victim = queues[(worker + offset) % workerCount];
+            const std::scoped_lock locker(victim.mutex);
+            if (!victim.jobs.empty()) {
+                jobOut = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    };
+    std::vector<std::thread> workers = {};
+    workers.reserve(workerCount);
+    for (std::size_t worker = 0; worker != workerCount; ++worker) {
+        workers.emplace_back([&takeJob, &job, worker]() {
+            std::size_t index = 0;
+            while (takeJob(worker, index)) {
+                job(worker, index);
+            }
+        });
+    }
+    for (auto &&worker : workers) {
+        worker.join();
+    }
+}
+
+[[nodiscard]] static inline bool getCacheKey(const FunctionCache &cache, const std::string &path, const std::uint32_t flags, const std::uint64_t context, std::uint64_t &keyOut)
+{
+    const MappedFile content(path);
+    if (!content.isValid()) {
+        std::cerr << "Failed to read the header file:" << path << std::endl;
+        return false;
+    }
+    keyOut = cache.key(std::string_view(content.data(), content.size()), flags, context);
+    return true;
+}
+
+// Looks up the flags of every header (null if there are none) in the compilation database, the headers
+// which don't have their own entry fall back to the nominated one. The flags live in "storage".
+[[nodiscard]] static inline bool resolveCompileFlags(const std::stringlist &paths, const ParseOptions &options, std::deque<CompileFlags> &storage, std::vector<const CompileFlags *> &flagsOut)
+{
+    flagsOut.assign(paths.size(), nullptr);
+    if (options.compilationDatabase.empty()) {
+        return true;
+    }
+    const CompilationDatabase database(options.compilationDatabase);
+    if (!database.isValid()) {
+        std::cerr << "Failed to load the compilation database from:" << options.compilationDatabase.string() << std::endl;
+        return false;
+    }
+    const CompileFlags *fallbackFlags = nullptr;
+    if (!options.compileCommandsEntry.empty()) {
+        CompileFlags flags = {};
+        if (!database.findFlags(toAbsolutePath(options.compileCommandsEntry), flags)) {
+            std::cerr << "The compilation database doesn't have any entry for:" << options.compileCommandsEntry << std::endl;
+            return false;
+        }
+        CompileFlags &storedFlags = storage.emplace_back(std::move(flags));
+        storedFlags.finalize();
+        fallbackFlags = &storedFlags;
+    }
+    std::size_t missingCount = 0;
+    for (std::size_t index = 0; index != paths.size(); ++index) {
+        CompileFlags flags = {};
+        if (database.findFlags(toAbsolutePath(paths[index]), flags)) {
+            CompileFlags &storedFlags = storage.emplace_back(std::move(flags));
+            storedFlags.finalize();
+            flagsOut[index] = &storedFlags;
+        } else {
+            flagsOut[index] = fallbackFlags;
+            if (!fallbackFlags) {
+                ++missingCount;
+            }
+        }
+    }
+    if (missingCount > 0) {
+        std::cout << missingCount << " header(s) don't have any entry in the compilation database, they are parsed without any flag." << std::endl;
+    }
+    return true;
+}
+
+[[nodiscard]] static inline bool hasErrors(const CXTranslationUnit unit)
+{
+    const std::uint32_t diagnosticCount = ::clang_getNumDiagnostics(unit);
+    for (std::uint32_t index = 0; index != diagnosticCount; ++index) {
+        const CXDiagnostic diagnostic = ::clang_getDiagnostic(unit, index);
+        const CXDiagnosticSeverity severity = ::clang_getDiagnosticSeverity(diagnostic);
+        ::clang_disposeDiagnostic(diagnostic);
+        if (severity >= CXDiagnostic_Error) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Builds the prefix header once for every distinct command line, and lets the headers include it
+// through "-include-pch", so that its (usually heavy) includes are only parsed once per run. With a
+// cache directory the precompiled headers are kept across the runs, otherwise they are temporary
+// files which are removed once the parsing is done.
+class PrecompiledHeaders
+{
+public:
+    explicit PrecompiledHeaders(const std::string_view prefixHeader, const FunctionCache *cache) : m_prefixHeader(toAbsolutePath(prefixHeader)), m_cache(cache) {}
+
+    ~PrecompiledHeaders() {
+        for (auto &&path : std::as_const(m_temporaryFiles)) {
+            std::error_code ec = {};
+            std::filesystem::remove(path, ec);
+        }
+    }
+
+    PrecompiledHeaders(const PrecompiledHeaders &) = delete;
+    PrecompiledHeaders &operator=(const PrecompiledHeaders &) = delete;
+
+    // Replaces the flags of every header with a copy which also includes the precompiled prefix header.
+    [[nodiscard]] inline bool apply(std::deque<CompileFlags> &storage, std::vector<const CompileFlags *> &headerFlags) {
+        const MappedFile content(m_prefixHeader);
+        if (!content.isValid()) {
+            std::cerr << "Failed to read the prefix header:" << m_prefixHeader << std::endl;
+            return false;
+        }
+        const IndexPtr index = createIndex();
+        if (!index) {
+            std::cerr << "libclang failed to create the index." << std::endl;
+            return false;
+        }
+        // The headers which have their own (but identical) command lines share one precompiled header.
+        std::map<std::uint64_t, const CompileFlags *> replacements = {};
+        for (auto &&flags : headerFlags) {
+            const bool fromDatabase = flags && flags->fromDatabase;
+            const std::uint64_t flagsKey = hashBytes(&fromDatabase, sizeof(fromDatabase), flags ? flags->hash : 0);
+            auto it = replacements.find(flagsKey);
+            if (it == replacements.end()) {
+                const CompileFlags *flagsWithPch = precompile(index.get(), std::string_view(content.data(), content.size()), flags, storage);
+                if (!flagsWithPch) {
+                    return false;
+                }
+                it = replacements.emplace(flagsKey, flagsWithPch).first;
+            }
+            flags = it->second;
+        }
+        return true;
+    }
+
+    // Loading the precompiled header is what every parse pays instead of parsing the prefix header again.
+    inline void report(const std::size_t parseCount) const {
+        const std::size_t loadCount = m_builtCount + m_reusedCount;
+        if (loadCount == 0) {
+            return;
+        }
+        const double loadMilliseconds = m_loadMilliseconds / double(loadCount);
+        std::cout << std::fixed << std::setprecision(1) << "Prefix header: " << m_builtCount << " precompiled, " << m_reusedCount << " reused from the cache, loading it takes " << loadMilliseconds << " ms";
+        if (m_builtCount > 0) {
+            const double parseMilliseconds = m_parseMilliseconds / double(m_builtCount);
+            const double savedMilliseconds = std::max(parseMilliseconds - loadMilliseconds, 0.0);
+            std::cout << " instead of " << parseMilliseconds << " ms, which saves about " << savedMilliseconds << " ms per header parse (" << (savedMilliseconds * double(parseCount)) << " ms for " << parseCount << " parse(s))";
+        }
+        std::cout << '.' << std::defaultfloat << std::endl;
+    }
+
+private:
+    [[nodiscard]] inline const CompileFlags *precompile(const CXIndex index, const std::string_view prefixContent, const CompileFlags *flags, std::deque<CompileFlags> &storage) {
+        static constexpr const std::uint32_t kPrecompileOptions = CXTranslationUnit_Incomplete | CXTranslationUnit_ForSerialization;
+        const std::uint64_t flagsHash = flags ? flags->hash : 0;
+        std::filesystem::path pchPath = {};
+        if (m_cache) {
+            // The flags may change the working directory.
+            pchPath = toAbsolutePath(m_cache->entryPath(m_cache->key(prefixContent, kPrecompileOptions, flagsHash), ".pch").string());
+        } else {
+            static thread_local std::mt19937_64 generator(std::random_device{}());
+            std::error_code ec = {};
+            pchPath = std::filesystem::temp_directory_path(ec) / ("dwg-" + std::to_string(generator()) + ".pch");
+            m_temporaryFiles.push_back(pchPath);
+        }
+        const std::stringlist arguments = flags ? flags->arguments : std::stringlist{};
+        std::error_code ec = {};
+        if (m_cache && std::filesystem::exists(pchPath, ec) && load(index, arguments, pchPath)) {
+            ++m_reusedCount;
+        } else {
+            if (!build(index, arguments, kPrecompileOptions, pchPath)) {
+                return nullptr;
+            }
+            if (!load(index, arguments, pchPath)) {
+                std::cerr << "libclang failed to load the precompiled prefix header:" << pchPath.string() << std::endl;
+                return nullptr;
+            }
+            ++m_builtCount;
+        }
+        CompileFlags &flagsWithPch = storage.emplace_back();
+        flagsWithPch.arguments = arguments;
+        flagsWithPch.arguments.push_back("-include-pch");
+        flagsWithPch.arguments.push_back(pchPath.string());
+        flagsWithPch.fromDatabase = flags && flags->fromDatabase;
+        flagsWithPch.finalize();
+        // The path of the precompiled header may be a temporary one, what matters to the function cache is its content.
+        flagsWithPch.hash = hashString(prefixContent, flagsHash);
+        return &flagsWithPch;
+    }
+
+    [[nodiscard]] inline bool build(const CXIndex index, const std::stringlist &arguments, const std::uint32_t options, const std::filesystem::path &pchPath) {
+        std::vector<const char *> argv = {};
+        for (auto &&argument : std::as_const(arguments)) {
+            argv.push_back(argument.c_str());
+        }
+        const auto startTime = std::chrono::steady_clock::now();
+        const TranslationUnitPtr unit(::clang_parseTranslationUnit(index, m_prefixHeader.c_str(), argv.data(), int(argv.size()), nullptr, 0, options), &::clang_disposeTranslationUnit);
+        m_parseMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        if (!unit || hasErrors(unit.get())) {
+            std::cerr << "libclang failed to precompile the prefix header:" << m_prefixHeader << std::endl;
+            return false;
+        }
+        // Same as writeFileAtomically(), the other runs which share the cache may be loading it right now.
+        static thread_local std::mt19937_64 generator(std::random_device{}());
+        std::filesystem::path tempPath = pchPath;
+        tempPath += ".tmp" + std::to_string(generator());
+        std::error_code ec = {};
+        if (::clang_saveTranslationUnit(unit.get(), tempPath.string().c_str(), ::clang_defaultSaveOptions(unit.get())) != CXSaveError_None) {
+            std::filesystem::remove(tempPath, ec);
+            std::cerr << "libclang failed to save the precompiled prefix header:" << pchPath.string() << std::endl;
+            return false;
+        }
+        std::filesystem::rename(tempPath, pchPath, ec);
+        if (ec) {
+            std::filesystem::remove(tempPath, ec);
+            std::cerr << "Failed to write the precompiled prefix header:" << pchPath.string() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Also tells whether a cached precompiled header is still valid, libclang rejects it if any of its inputs changed.
+    [[nodiscard]] inline bool load(const CXIndex index, const std::stringlist &arguments, const std::filesystem::path &pchPath) {
+        static constexpr const char kCheckFileName[] = "dwg_pch_check.h";
+        const std::string pchPathStr = pchPath.string();
+        std::vector<const char *> argv = {};
+        for (auto &&argument : std::as_const(arguments)) {
+            argv.push_back(argument.c_str());
+        }
+        argv.push_back("-include-pch");
+        argv.push_back(pchPathStr.c_str());
+        CXUnsavedFile unsavedFile = {};
+        unsavedFile.Filename = kCheckFileName;
+        unsavedFile.Contents = "";
+        unsavedFile.Length = 0;
+        const auto startTime = std::chrono::steady_clock::now();
+        const TranslationUnitPtr unit(::clang_parseTranslationUnit(index, kCheckFileName, argv.data(), int(argv.size()), &unsavedFile, 1, CXTranslationUnit_Incomplete), &::clang_disposeTranslationUnit);
+        const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        if (!unit || hasErrors(unit.get())) {
+            return false;
+        }
+        m_loadMilliseconds += milliseconds;
+        return true;
+    }
+
+    std::string m_prefixHeader = {};
+    const FunctionCache *m_cache = nullptr;
+    std::vector<std::filesystem::path> m_temporaryFiles = {};
+    std::size_t m_builtCount = 0;
+    std::size_t m_reusedCount = 0;
+    double m_parseMilliseconds = 0.0;
+    double m_loadMilliseconds = 0.0;
+};
+
+[[nodiscard]] static inline bool parseHeadersSeparately(const std::stringlist &paths, const ParseOptions &options, const FunctionCache *cache, Headers &headersOut)
+{
+    std::deque<CompileFlags> flagsStorage = {};
+    std::vector<const CompileFlags *> headerFlags = {};
+    if (!resolveCompileFlags(paths, options, flagsStorage, headerFlags)) {
+        return false;
+    }
+    std::unique_ptr<PrecompiledHeaders> precompiledHeaders = {};
+    if (!options.prefixHeader.empty()) {
+        precompiledHeaders = std::make_unique<PrecompiledHeaders>(options.prefixHeader, cache);
+        if (!precompiledHeaders->apply(flagsStorage, headerFlags)) {
+            return false;
+        }
+    }
+    // Every worker owns one index for the whole run, which is reused by all the headers it parses.
+    const std::size_t workerCount = std::clamp(options.threadCount, std::size_t(1), paths.size());
+    std::vector<IndexPtr> indexes = {};
+    indexes.reserve(workerCount);
+    // Hand the borrowed indexes back to the pool, however we leave.
+    struct IndexReturner
+    {
+        IndexPool *pool = nullptr;
+        std::vector<IndexPtr> &indexes;
+
+        ~IndexReturner() {
+            if (pool) {
+                for (auto &&index : indexes) {
+                    pool->release(std::move(index));
+                }
+            }
+        }
+    } indexReturner{ options.indexPool, indexes };
+    for (std::size_t worker = 0; worker != workerCount; ++worker) {
+        IndexPtr index = options.indexPool ? options.indexPool->acquire() : createIndex();
+        if (!index) {
+            std::cerr << "libclang failed to create the index." << std::endl;
+            return false;
+        }
+        indexes.push_back(std::move(index));
+    }
+    // Schedule the largest headers first, they are the most likely ones to become the tail of the whole run.
+    std::vector<std::uintmax_t> fileSizes(paths.size(), 0);
+    for (std::size_t index = 0; index != paths.size(); ++index) {
+        std::error_code ec = {};
+        const std::uintmax_t fileSize = std::filesystem::file_size(paths[index], ec);
+        fileSizes[index] = ec ? 0 : fileSize;
+    }
+    std::vector<std::size_t> order(paths.size(), 0);
+    for (std::size_t index = 0; index != order.size(); ++index) {
+        order[index] = index;
+    }
+    std::stable_sort(order.begin(), order.end(), [&fileSizes](const std::size_t lhs, const std::size_t rhs) -> bool { return fileSizes[lhs] > fileSizes[rhs]; });
+    // Every job writes to its own slot, the headers are still in the command line order in the end.
+    Headers headers(paths.size());
+    std::atomic_bool failed = false;
+    std::atomic_size_t cacheHits = 0;
+    runJobs(order, workerCount, [&paths, &options, cache, &headerFlags, &indexes, &headers, &failed, &cacheHits](const std::size_t worker, const std::size_t index) {
+        if (failed.load(std::memory_order_relaxed)) {
+            return;
+        }
+        const CompileFlags *flags = headerFlags[index];
+        const std::uint32_t translationUnitFlags = getTranslationUnitFlags(!(flags && flags->fromDatabase));
+        const std::uint64_t context = flags ? flags->hash : 0;
+        const auto parseHeader = [&](Functions &functionsOut, std::stringlist &dependenciesOut) -> bool {
+            std::uint64_t cacheKey = 0;
+            if (cache) {
+                if (!getCacheKey(*cache, paths[index], translationUnitFlags, context, cacheKey)) {
+                    return false;
+                }
+                if (cache->load(cacheKey, functionsOut, dependenciesOut) && !functionsOut.empty()) {
+                    cacheHits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            if (!parseTranslationUnit(indexes[worker].get(), paths[index], flags, functionsOut, dependenciesOut) || functionsOut.empty()) {
+                return false;
+            }
+            // A failure to store the entry only costs us a re-parse next time, it's not fatal.
+            if (cache && !cache->store(cacheKey, functionsOut, dependenciesOut)) {
+                std::cerr << "Failed to store the cache entry for:" << paths[index] << std::endl;
+            }
+            if (options.memoryGuard.exceeded()) {
+                std::cerr << "The peak memory usage exceeded the limit (" << options.memoryGuard.limit << " MiB) while parsing:" << paths[index] << std::endl;
+                return false;
+            }
+            return true;
+        };
+        Functions functions = {};
+        std::stringlist dependencies = {};
+        const bool parsed = options.sharedCache
+            ? options.sharedCache->findOrParse(paths[index], translationUnitFlags, context, parseHeader, functions, dependencies)
+            : parseHeader(functions, dependencies);
+        if (!parsed) {
+            failed.store(true, std::memory_order_relaxed);
+            return;
+        }
+        headers[index].filename = extractFileName(paths[index]);
+        headers[index].functions = std::move(functions);
+        headers[index].dependencies = std::move(dependencies);
+    });
+    if (failed.load()) {
+        return false;
+    }
+    if (cache) {
+        std::cout << "Function cache: " << cacheHits.load() << " hit(s), " << (paths.size() - cacheHits.load()) << " miss(es)." << std::endl;
+    }
+    if (precompiledHeaders) {
+        precompiledHeaders->report(paths.size() - cacheHits.load());
+    }
+    headersOut = std::move(headers);
+    return true;
+}
+
+[[nodiscard]] static inline bool parseHeadersTogether(const std::stringlist &paths, const ParseOptions &options, const FunctionCache *cache, Headers &headersOut)
+{
+    std::deque<CompileFlags> flagsStorage = {};
+    std::vector<const CompileFlags *> headerFlags = {};
+    if (!resolveCompileFlags(paths, options, flagsStorage, headerFlags)) {
+        return false;
+    }
+    // There's only one command line, the nominated entry wins, otherwise the first header which has its own entry does.
+    const auto flagsIt = std::find_if(headerFlags.cbegin(), headerFlags.cend(), [](const CompileFlags *flags) -> bool { return flags != nullptr; });
+    const CompileFlags *compileFlags = flagsStorage.empty() ? nullptr : (options.compileCommandsEntry.empty() ? *flagsIt : &flagsStorage.front());
+    std::unique_ptr<PrecompiledHeaders> precompiledHeaders = {};
+    if (!options.prefixHeader.empty()) {
+        precompiledHeaders = std::make_unique<PrecompiledHeaders>(options.prefixHeader, cache);
+        std::vector<const CompileFlags *> umbrellaFlags = { compileFlags };
+        if (!precompiledHeaders->apply(flagsStorage, umbrellaFlags)) {
+            return false;
+        }
+        compileFlags = umbrellaFlags.front();
+    }
+    Headers headers(paths.size());
+    for (std::size_t index = 0; index != paths.size(); ++index) {
+        headers[index].filename = extractFileName(paths[index]);
+    }
+    // What a header yields depends on the headers included before it, so the whole list of
+    // headers is part of the cache key, and we can only skip the parse when every header hits.
+    const std::uint32_t flags = getTranslationUnitFlags(false);
+    std::vector<std::uint64_t> cacheKeys(paths.size(), 0);
+    if (cache) {
+        std::uint64_t context = compileFlags ? compileFlags->hash : 0;
+        for (auto &&path : std::as_const(paths)) {
+            context = hashString(path, context);
+        }
+        std::size_t cacheHits = 0;
+        for (std::size_t index = 0; index != paths.size(); ++index) {
+            if (!getCacheKey(*cache, paths[index], flags, context, cacheKeys[index])) {
+                return false;
+            }
+            if (cache->load(cacheKeys[index], headers[index].functions, headers[index].dependencies) && !headers[index].functions.empty()) {
+                ++cacheHits;
+            }
+        }
+        if (cacheHits == paths.size()) {
+            std::cout << "Function cache: " << cacheHits << " hit(s), 0 miss(es)." << std::endl;
+            headersOut = std::move(headers);
+            return true;
+        }
+        std::cout << "Function cache: " << cacheHits << " hit(s), " << (paths.size() - cacheHits) << " miss(es), re-parsing all the headers." << std::endl;
+    }
+    const IndexPtr clangIndex = createIndex();
+    if (!clangIndex) {
+        std::cerr << "libclang failed to create the index." << std::endl;
+        return false;
+    }
+    std::vector<Functions> functions = {};
+    std::vector<std::stringlist> dependencies = {};
+    if (!parseUmbrellaTranslationUnit(clangIndex.get(), paths, compileFlags, functions, dependencies)) {
+        return false;
+    }
+    if (precompiledHeaders) {
+        precompiledHeaders->report(1);
+    }
+    if (options.memoryGuard.exceeded()) {
+        std::cerr << "The peak memory usage exceeded the limit (" << options.memoryGuard.limit << " MiB) while parsing the umbrella translation unit." << std::endl;
+        return false;
+    }
+    for (std::size_t index = 0; index != paths.size(); ++index) {
+        if (functions[index].empty()) {
+            std::cerr << "No function was found in:" << paths[index] << std::endl;
+            return false;
+        }
+        if (cache && !cache->store(cacheKeys[index], functions[index], dependencies[index])) {
+            std::cerr << "Failed to store the cache entry for:" << paths[index] << std::endl;
+        }
+        headers[index].functions = std::move(functions[index]);
+        headers[index].dependencies = std::move(dependencies[index]);
+    }
+    headersOut = std::move(headers);
+    return true;
+}
+
+[[nodiscard]] static inline bool parseHeaders(const std::stringlist &paths, const ParseOptions &options, Headers &headersOut)
+{
+    if (paths.empty()) {
+        return false;
+    }
+    std::unique_ptr<FunctionCache> cache = {};
+    if (!options.cacheDirectory.empty()) {
+        cache = std::make_unique<FunctionCache>(options.cacheDirectory);
+        if (!cache->initialize()) {
+            return false;
+        }
+    }
+    if (options.umbrella) {
+        return parseHeadersTogether(paths, options, cache.get(), headersOut);
+    }
+    return parseHeadersSeparately(paths, options, cache.get(), headersOut);
+}
+
+// Keeps the translation unit of every header alive, so that only the headers which have changed (or whose
+// includes have) need to be parsed again, and libclang reuses their precompiled preambles when it does so.
+class WatchSession
+{
+public:
+    explicit WatchSession(const std::stringlist &paths, const ParseOptions &options) : m_paths(paths), m_options(options) {}
+
+    WatchSession(const WatchSession &) = delete;
+    WatchSession &operator=(const WatchSession &) = delete;
+
+    [[nodiscard]] inline bool initialize(Headers &headersOut) {
+        if (!resolveCompileFlags(m_paths, m_options, m_flagsStorage, m_headerFlags)) {
+            return false;
+        }
+        if (!m_options.prefixHeader.empty()) {
+            m_precompiledHeaders = std::make_unique<PrecompiledHeaders>(m_options.prefixHeader, nullptr);
+            if (!m_precompiledHeaders->apply(m_flagsStorage, m_headerFlags)) {
+                return false;
+            }
+        }
+        m_index = createIndex();
+        if (!m_index) {
+            std::cerr << "libclang failed to create the index." << std::endl;
+            return false;
+        }
+        Headers headers(m_paths.size());
+        for (std::size_t index = 0; index != m_paths.size(); ++index) {
+            headers[index].filename = extractFileName(m_paths[index]);
+            m_units.push_back(createTranslationUnit(m_index.get(), m_paths[index], m_headerFlags[index], kResidentOptions));
+            if (!m_units.back() || !extract(index, headers[index])) {
+                return false;
+            }
+        }
+        headersOut = std::move(headers);
+        return true;
+    }
+
+    [[nodiscard]] inline bool reparse(const std::vector<std::size_t> &indexes, Headers &headers) {
+        for (auto &&index : std::as_const(indexes)) {
+            TranslationUnitPtr &unit = m_units[index];
+            // A failed reparse leaves the translation unit unusable, start it over.
+            if (!unit || (::clang_reparseTranslationUnit(unit.get(), 0, nullptr, ::clang_defaultReparseOptions(unit.get())) != 0)) {
+                unit = createTranslationUnit(m_index.get(), m_paths[index], m_headerFlags[index], kResidentOptions);
+            }
+            if (!unit || !extract(index, headers[index])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr const std::uint32_t kResidentOptions = CXTranslationUnit_PrecompiledPreamble;
+
+    [[nodiscard]] inline bool extract(const std::size_t index, Header &headerOut) const {
+        Functions functions = {};
+        std::stringlist dependencies = {};
+        if (!extractTranslationUnit(m_units[index].get(), m_paths[index], m_headerFlags[index], functions, dependencies)) {
+            return false;
+        }
+        if (functions.empty()) {
+            std::cerr << "No function was found in:" << m_paths[index] << std::endl;
+        }
+        headerOut.functions = std::move(functions);
+        headerOut.dependencies = std::move(dependencies);
+        return true;
+    }
+
+    std::stringlist m_paths = {};
+    ParseOptions m_options = {};
+    std::deque<CompileFlags> m_flagsStorage = {};
+    std::vector<const CompileFlags *> m_headerFlags = {};
+    std::unique_ptr<PrecompiledHeaders> m_precompiledHeaders = {};
+    IndexPtr m_index = { nullptr, &::clang_disposeIndex };
+    std::vector<TranslationUnitPtr> m_units = {}; // Must be disposed before the index.
+};
+
+// Waits for the given files to be modified. The directories are watched instead of the files, so that
+// the editors which save through a temporary file and a rename are noticed as well. Where there's no
+// inotify the modification times are polled. The watcher lives as long as the session, only the set of
+// watched files changes, so that the changes made while the wrapper is being regenerated are not lost.
+class FileWatcher
+{
+public:
+    FileWatcher() {
+#ifdef __linux__
+        m_fd = ::inotify_init1(IN_CLOEXEC);
+#endif
+    }
+
+    ~FileWatcher() {
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+#endif
+    }
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    [[nodiscard]] inline bool isValid() const {
+#ifdef __linux__
+        return m_fd >= 0;
+#else
+        return true;
+#endif
+    }
+
+    [[nodiscard]] inline std::size_t fileCount() const {
+        return m_files.size();
+    }
+
+    // Replaces the watched files, wait() reports the indexes into "files". Only the directories which
+    // weren't watched yet are added, the ones which are not needed anymore are removed.
+    [[nodiscard]] inline bool watch(const std::stringlist &files) {
+        m_files.clear();
+        for (std::size_t index = 0; index != files.size(); ++index) {
+            m_files[toAbsolutePath(files[index])].push_back(index);
+        }
+#ifdef __linux__
+        std::map<int, std::string> directories = {};
+        for (auto &&file : std::as_const(m_files)) {
+            const std::string directory = std::filesystem::path(file.first).parent_path().string();
+            // Adding the same directory again returns the same descriptor.
+            const int wd = ::inotify_add_watch(m_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0) {
+                return false;
+            }
+            directories.emplace(wd, directory);
+        }
+        for (auto &&directory : std::as_const(m_directories)) {
+            if (!directories.contains(directory.first)) {
+                ::inotify_rm_watch(m_fd, directory.first);
+            }
+        }
+        m_directories = std::move(directories);
+#else
+        // The files which were watched already keep their old time, so that a change in between is noticed.
+        std::map<std::string, std::filesystem::file_time_type> modificationTimes = {};
+        for (auto &&file : std::as_const(m_files)) {
+            const auto it = m_modificationTimes.find(file.first);
+            if (it != m_modificationTimes.cend()) {
+                modificationTimes.insert(*it);
+                continue;
+            }
+            std::error_code ec = {};
+            modificationTimes[file.first] = std::filesystem::last_write_time(file.first, ec);
+        }
+        m_modificationTimes = std::move(modificationTimes);
+#endif
+        return true;
+    }
+
+    // Blocks until some of the files have changed and returns their indexes, or nothing if the watch failed.
+    // An editor usually touches a file several times when it saves it, the events which arrive in a short
+    // while are coalesced. The events of the other files in the watched directories are ignored.
+    [[nodiscard]] inline std::vector<std::size_t> wait() {
+        static constexpr const int kSettleMilliseconds = 50;
+        std::vector<std::size_t> changed = {};
+#ifdef __linux__
+        pollfd pfd = {};
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        int timeout = -1;
+        while (true) {
+            const int ready = ::poll(&pfd, 1, timeout);
+            if ((ready < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (ready <= 0) {
+                break;
+            }
+            alignas(inotify_event) char buffer[16 * 1024];
+            const ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+            for (ssize_t offset = 0; offset < length;) {
+                const auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                offset += ssize_t(sizeof(inotify_event) + event->len);
+                // Some events were dropped, we can't tell which files they were about.
+                if (event->mask & IN_Q_OVERFLOW) {
+                    for (auto &&file : std::as_const(m_files)) {
+                        changed.insert(changed.end(), file.second.cbegin(), file.second.cend());
+                    }
+                    continue;
+                }
+                const auto directory = m_directories.find(event->wd);
+                if ((event->len == 0) || (directory == m_directories.cend())) {
+                    continue;
+                }
+                const auto file = m_files.find((std::filesystem::path(directory->second) / event->name).string());
+                if (file != m_files.cend()) {
+                    changed.insert(changed.end(), file->second.cbegin(), file->second.cend());
+                }
+            }
+            if (!changed.empty()) {
+                timeout = kSettleMilliseconds;
+            }
+        }
+#else
+        while (true) {
+            for (auto &&file : std::as_const(m_files)) {
+                std::error_code ec = {};
+                const std::filesystem::file_time_type modificationTime = std::filesystem::last_write_time(file.first, ec);
+                if (!ec && (modificationTime != m_modificationTimes[file.first])) {
+                    m_modificationTimes[file.first] = modificationTime;
+                    changed.insert(changed.end(), file.second.cbegin(), file.second.cend());
+                }
+            }
+            if (!changed.empty()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(kSettleMilliseconds * 4));
+        }
+#endif
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        return changed;
+    }
+
+private:
+    std::map<std::string, std::vector<std::size_t>> m_files = {};
+#ifdef __linux__
+    int m_fd = -1;
+    std::map<int, std::string> m_directories = {};
+#else
+    std::map<std::string, std::filesystem::file_time_type> m_modificationTimes = {};
+#endif
+};
+
+// Stays resident and calls "generate" again whenever a header or any of its includes changes.
+[[nodiscard]] static inline bool watchHeaders(const std::stringlist &paths, const ParseOptions &options, const std::function<bool(const Headers &)> &generate)
+{
+    if (paths.empty()) {
+        return false;
+    }
+    WatchSession session(paths, options);
+    Headers headers = {};
+    if (!session.initialize(headers) || !generate(headers)) {
+        return false;
+    }
+    FileWatcher watcher = {};
+    if (!watcher.isValid()) {
+        std::cerr << "Failed to watch the header files." << std::endl;
+        return false;
+    }
+    while (true) {
+        // The includes may have changed since the last time, so the watched files are collected again.
+        std::stringlist files = {};
+        std::vector<std::size_t> fileHeaders = {};
+        for (std::size_t index = 0; index != headers.size(); ++index) {
+            files.push_back(paths[index]);
+            fileHeaders.push_back(index);
+            for (auto &&dependency : std::as_const(headers[index].dependencies)) {
+                files.push_back(dependency);
+                fileHeaders.push_back(index);
+            }
+        }
+        if (!watcher.watch(files)) {
+            std::cerr << "Failed to watch the header files." << std::endl;
+            return false;
+        }
+        std::cout << "Watching " << watcher.fileCount() << " file(s) for changes, press Ctrl+C to quit." << std::endl;
+        const std::vector<std::size_t> changedFiles = watcher.wait();
+        if (changedFiles.empty()) {
+            std::cerr << "Failed to wait for the header files to change." << std::endl;
+            return false;
+        }
+        std::vector<std::size_t> changedHeaders = {};
+        for (auto &&file : changedFiles) {
+            changedHeaders.push_back(fileHeaders[file]);
+        }
+        std::sort(changedHeaders.begin(), changedHeaders.end());
+        changedHeaders.erase(std::unique(changedHeaders.begin(), changedHeaders.end()), changedHeaders.end());
+        const auto startTime = std::chrono::steady_clock::now();
+        if (!session.reparse(changedHeaders, headers) || !generate(headers)) {
+            std::cerr << "Failed to regenerate the wrapper source, waiting for the next change." << std::endl;
+            continue;
+        }
+        const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "Reparsed " << changedHeaders.size() << " header(s) and regenerated in " << std::fixed << std::setprecision(1) << milliseconds << " ms." << std::defaultfloat << std::endl;
+    }
+}
+
+// The generated source is assembled in memory and written to the disk at once, the stream is never flushed in
+// between, and the numbers are formatted in place, without any temporary string.
+class OutputBuffer
+{
+public:
+    explicit OutputBuffer(const std::size_t capacity = 0) {
+        m_data.reserve(capacity);
+    }
+
+    [[nodiscard]] inline std::string_view view() const {
+        return m_data;
+    }
+
+    inline OutputBuffer &operator<<(const std::string_view str) {
+        m_data.append(str);
+        return *this;
+    }
+
+    inline OutputBuffer &operator<<(const char *str) {
+        m_data.append(str);
+        return *this;
+    }
+
+    inline OutputBuffer &operator<<(const std::string &str) {
+        m_data.append(str);
+        return *this;
+    }
+
+    inline OutputBuffer &operator<<(const char c) {
+        m_data.push_back(c);
+        return *this;
+    }
+
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, bool>>>
+    inline OutputBuffer &operator<<(const T value) {
+        char buffer[24] = {};
+        const auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        m_data.append(buffer, ptr);
+        return *this;
+    }
+
+private:
+    std::string m_data = {};
+};
+
+enum class BindingMode
+{
+    Lazy, // Every wrapper resolves its own symbol on its first call.
+    Table, // All the symbols are resolved at once, into one table.
+    Thunk, // Like "Table", but the wrappers are assembly stubs which jump through the table.
+    IFunc // The wrappers are GNU indirect functions, the dynamic linker binds them to the real functions.
+};
+
+struct GeneratorOptions
+{
+    std::string dllFileName = {};
+    bool sysDirOnly = false;
+    BindingMode binding = BindingMode::Lazy;
+    bool fallbackStubs = false;
+    bool instrument = false;
+    bool directLookup = false;
+    bool offsetCache = false;
+    bool preload = false;
+    std::uint32_t pageTraceSeconds = 0; // 0 means no page trace.
+    bool writeIfChanged = false;
+    bool exportSymbolTable = false; // Set when an inline header is generated too, its accessors read the table.
+    std::string sourceDateEpoch = {}; // SOURCE_DATE_EPOCH of the process which asked for the wrapper.
+};
+
+[[nodiscard]] static inline bool toBindingMode(const std::string_view str, BindingMode &modeOut)
+{
+    const std::string mode = toLower(str);
+    if (mode == "lazy") {
+        modeOut = BindingMode::Lazy;
+        return true;
+    }
+    if (mode == "table") {
+        modeOut = BindingMode::Table;
+        return true;
+    }
+    if (mode == "thunk") {
+        modeOut = BindingMode::Thunk;
+        return true;
+    }
+    if (mode == "ifunc") {
+        modeOut = BindingMode::IFunc;
+        return true;
+    }
+    return false;
+}
+
+[[nodiscard]] static inline constexpr bool usesSymbolTable(const BindingMode mode)
+{
+    return (mode == BindingMode::Table) || (mode == BindingMode::Thunk);
+}
+
+[[nodiscard]] static inline constexpr bool canWrapVariadicFunctions(const BindingMode mode)
+{
+    return (mode == BindingMode::Thunk) || (mode == BindingMode::IFunc);
+}
+
+// The thunks and the ifuncs jump (or are bound) straight to the real function, there's no wrapper code we can add anything to.
+[[nodiscard]] static inline constexpr bool hasWrapperFrame(const BindingMode mode)
+{
+    return (mode == BindingMode::Lazy) || (mode == BindingMode::Table);
+}
+
+// Makes a string usable as (a part of) a C identifier.
+[[nodiscard]] static inline std::string toIdentifier(const std::string_view str)
+{
+    std::string result(str);
+    std::replace_if(result.begin(), result.end(), [](unsigned char c) -> bool { return !std::isalnum(c); }, '_');
+    return result;
+}
+
+// True where the library is linked directly (always the case with Emscripten), either all of them (DWG_DIRECT_LINK)
+// or just this one (DWG_DIRECT_LINK_<DLL name>), the same generated files serve both configurations.
+static inline void writeDirectLinkCondition(OutputBuffer &out, const GeneratorOptions &options)
+{
+    out << "defined(__EMSCRIPTEN__) || defined(DWG_DIRECT_LINK) || defined(DWG_DIRECT_LINK_" << toIdentifier(options.dllFileName) << ")";
+}
+
+// The exported table is named after the library, so that the wrappers of several libraries can be linked together.
+[[nodiscard]] static inline std::string exportedSymbolTableName(const GeneratorOptions &options)
+{
+    return "DWG_" + toIdentifier(options.dllFileName) + "_SymbolTable";
+}
+
+[[nodiscard]] static inline constexpr bool isVoidType(const std::string_view type)
+{
+    return type.empty() || (type == "void");
+}
+
+// The C calling convention is the default everywhere, but only the Windows compilers know the "__cdecl" keyword,
+// it's spelled through a macro which is empty everywhere else.
+[[nodiscard]] static inline constexpr std::string_view toCallingConventionMacro(const std::string_view callingConvention)
+{
+    return (callingConvention == "__cdecl") ? "DWG_CDECL" : callingConvention;
+}
+
+// Writes "<result type> <calling convention> <name prefix><name>(<parameters>)", the parameters are named "arg1", "arg2" and so on.
+template<typename T>
+static inline void writeFunctionSignature(OutputBuffer &out, const Function &function, const std::string_view namePrefix, const T &name, const bool namedParameters = true)
+{
+    out << function.resultType;
+    if (!(isPointerType(function.resultType) || isReferenceType(function.resultType))) {
+        out << ' ';
+    }
+    out << toCallingConventionMacro(function.callingConvention) << ' ' << namePrefix << name << '(';
+    for (std::size_t index = 0; index != function.parameters.size(); ++index) {
+        const std::string &parameter = function.parameters[index];
+        out << parameter;
+        if (namedParameters) {
+            if (!(isPointerType(parameter) || isReferenceType(parameter))) {
+                out << ' ';
+            }
+            out << "arg" << (index + 1);
+        }
+        if (index < function.parameters.size() - 1) {
+            out << ", ";
+        }
+    }
+    if (function.variadic) {
+        out << (function.parameters.empty() ? "..." : ", ...");
+    }
+    out << ')';
+}
+
+// Writes "(arg1, arg2, ...)".
+static inline void writeCallArguments(OutputBuffer &out, const Function &function)
+{
+    out << '(';
+    for (std::size_t index = 0; index != function.parameters.size(); ++index) {
+        out << "arg" << (index + 1);
+        if (index < function.parameters.size() - 1) {
+            out << ", ";
+        }
+    }
+    out << ')';
+}
+
+// Calls "function" if it's not null, otherwise returns the default value of the result type. With a profile the
+// missing symbol is marked as the unlikely case, so that the call stays on the straight path of the hot wrappers.
+static inline void writeGuardedCall(OutputBuffer &out, const Function &function, const bool unlikelyMissing = false)
+{
+    if (!unlikelyMissing) {
+        out << "    if (function) { ";
+        if (isVoidType(function.resultType)) {
+            out << "function";
+            writeCallArguments(out, function);
+            out << "; }";
+        } else {
+            out << "return function";
+            writeCallArguments(out, function);
+            // "return T{};" doesn't compile for types like "const char *", let the compiler deduce it.
+            out << "; } else { return {}; }";
+        }
+        out << '\n';
+        return;
+    }
+    if (isVoidType(function.resultType)) {
+        out << "    if (!function) DWG_UNLIKELY { return; }\n";
+        out << "    function";
+    } else {
+        // "return T{};" doesn't compile for types like "const char *", let the compiler deduce it.
+        out << "    if (!function) DWG_UNLIKELY { return {}; }\n";
+        out << "    return function";
+    }
+    writeCallArguments(out, function);
+    out << ";\n";
+}
+
+[[nodiscard]] static inline constexpr bool usesFallbackStubs(const GeneratorOptions &options)
+{
+    return options.fallbackStubs && (options.binding == BindingMode::Table);
+}
+
+// Writes one stub for every distinct signature, which returns the default value of the result type. The table slots
+// of the missing symbols point to them, so the wrappers can call through their slot unconditionally. Returns the
+// index of the stub of every function (in the table order), or "npos" for the functions which don't have any.
+// Only the thunks can call the stubs of the variadic functions, the wrappers skip them.
+[[nodiscard]] static inline std::vector<std::size_t> writeFallbackStubs(OutputBuffer &out, const Headers &headers, const bool variadicStubs)
+{
+    out << "#if defined(__GNUC__) || defined(__clang__)\n";
+    out << "#  ifdef __ELF__\n";
+    out << "#    define DWG_COLD __attribute__((cold, noinline, section(\".text.unlikely\")))\n";
+    out << "#  else\n";
+    out << "#    define DWG_COLD __attribute__((cold, noinline))\n";
+    out << "#  endif\n";
+    out << "#elif defined(_MSC_VER)\n";
+    out << "#  define DWG_COLD __declspec(noinline)\n";
+    out << "#else\n";
+    out << "#  define DWG_COLD\n";
+    out << "#endif\n";
+    // Counting the hits is opt-in, it costs an atomic increment on every call of a missing function.
+    out << "#ifdef DWG_COUNT_MISSING_SYMBOLS\n";
+    out << "#  include <atomic>\n";
+    out << "static std::atomic<std::uint64_t> DWG_MissingSymbolHits = 0;\n";
+    out << "extern \"C\" std::uint64_t DWG_GetMissingSymbolHitCount() { return DWG_MissingSymbolHits.load(std::memory_order_relaxed); }\n";
+    out << "#  define DWG_COUNT_MISSING_SYMBOL_HIT() DWG_MissingSymbolHits.fetch_add(1, std::memory_order_relaxed)\n";
+    out << "#else\n";
+    out << "#  define DWG_COUNT_MISSING_SYMBOL_HIT() static_cast<void>(0)\n";
+    out << "#endif\n";
+    std::vector<std::size_t> stubIndexes = {};
+    std::map<std::string, std::size_t> signatures = {};
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            if (function.variadic && !variadicStubs) {
+                stubIndexes.push_back(std::string::npos);
+                continue;
+            }
+            std::string signature = function.resultType + '|' + function.callingConvention + (function.variadic ? "|..." : "");
+            for (auto &&parameter : std::as_const(function.parameters)) {
+                signature += '|' + parameter;
+            }
+            const auto [it, inserted] = signatures.emplace(signature, signatures.size());
+            stubIndexes.push_back(it->second);
+            if (!inserted) {
+                continue;
+            }
+            out << "DWG_COLD static ";
+            writeFunctionSignature(out, function, "DWG_MissingSymbolStub", it->second, false);
+            out << " { DWG_COUNT_MISSING_SYMBOL_HIT();";
+            if (!isVoidType(function.resultType)) {
+                out << " return {};";
+            }
+            out << " }\n";
+        }
+    }
+    return stubIndexes;
+}
+
+// dlsym() takes a lock, hashes the name and searches the whole dependency scope of the library for every single
+// symbol. With the direct lookup the table is resolved in one pass over the GNU hash table of the library itself,
+// found through its link map, with the hashes computed at generation time. Whatever it can't resolve on its own
+// (ifuncs, the symbols of the dependencies, a library without a GNU hash table) is still left to dlsym().
+static inline void writeDirectLookup(OutputBuffer &out, const Headers &headers)
+{
+    out << "#if defined(__linux__) && defined(__ELF__) && !defined(__ANDROID__)\n";
+    out << "#  define DWG_HAS_DIRECT_LOOKUP\n";
+    out << "#  include <link.h>\n";
+    out << "#  include <cstring>\n";
+    out << "static constexpr const std::uint32_t DWG_SymbolHashes[DWG_SymbolCount] = {\n";
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "    " << gnuHash(function.name) << "u,\n";
+        }
+    }
+    out << "};\n";
+    out << "class DWG_DirectLookup {\n";
+    out << "public:\n";
+    out << "    explicit DWG_DirectLookup(const DWG_LibraryHandle library) {\n";
+    out << "        struct link_map *map = nullptr;\n";
+    out << "        if ((::dlinfo(library, RTLD_DI_LINKMAP, &map) != 0) || !map || !map->l_ld) { return; }\n";
+    out << "        m_base = map->l_addr;\n";
+    // glibc relocates the pointers of the dynamic section in place, musl doesn't.
+    out << "        const auto address = [this](const ElfW(Addr) value) -> ElfW(Addr) { return (value < m_base) ? (m_base + value) : value; };\n";
+    out << "        const std::uint32_t *hashTable = nullptr;\n";
+    out << "        for (const ElfW(Dyn) *entry = map->l_ld; entry->d_tag != DT_NULL; ++entry) {\n";
+    out << "            switch (entry->d_tag) {\n";
+    out << "            case DT_GNU_HASH: hashTable = reinterpret_cast<const std::uint32_t *>(address(entry->d_un.d_ptr)); break;\n";
+    out << "            case DT_SYMTAB: m_symbols = reinterpret_cast<const ElfW(Sym) *>(address(entry->d_un.d_ptr)); break;\n";
+    out << "            case DT_STRTAB: m_strings = reinterpret_cast<const char *>(address(entry->d_un.d_ptr)); break;\n";
+    out << "            case DT_VERSYM: m_versions = reinterpret_cast<const ElfW(Half) *>(address(entry->d_un.d_ptr)); break;\n";
+    out << "            default: break;\n";
+    out << "            }\n";
+    out << "        }\n";
+    out << "        if (!hashTable || !m_symbols || !m_strings || (hashTable[0] == 0) || (hashTable[2] == 0)) { return; }\n";
+    out << "        m_bucketCount = hashTable[0];\n";
+    out << "        m_firstHashedSymbol = hashTable[1];\n";
+    out << "        m_bloomMask = hashTable[2] - 1;\n";
+    out << "        m_bloomShift = hashTable[3];\n";
+    out << "        m_bloom = reinterpret_cast<const ElfW(Addr) *>(hashTable + 4);\n";
+    out << "        m_buckets = reinterpret_cast<const std::uint32_t *>(m_bloom + hashTable[2]);\n";
+    out << "        m_chain = m_buckets + m_bucketCount;\n";
+    out << "    }\n";
+    out << "    [[nodiscard]] DWG_FunctionPointer find(const std::uint32_t index) const {\n";
+    out << "        if (!m_buckets) { return nullptr; }\n";
+    out << "        static constexpr const std::uint32_t wordBits = sizeof(ElfW(Addr)) * 8;\n";
+    out << "        const std::uint32_t hash = DWG_SymbolHashes[index];\n";
+    out << "        const ElfW(Addr) mask = (ElfW(Addr)(1) << (hash % wordBits)) | (ElfW(Addr)(1) << ((hash >> m_bloomShift) % wordBits));\n";
+    out << "        if ((m_bloom[(hash / wordBits) & m_bloomMask] & mask) != mask) { return nullptr; }\n";
+    out << "        std::uint32_t symbolIndex = m_buckets[hash % m_bucketCount];\n";
+    out << "        if (symbolIndex < m_firstHashedSymbol) { return nullptr; }\n";
+    out << "        const char * const name = &DWG_SymbolNames[DWG_SymbolNameOffsets[index]];\n";
+    out << "        while (true) {\n";
+    // The lowest bit of a chain entry marks the end of the chain.
+    out << "            const std::uint32_t chainHash = m_chain[symbolIndex - m_firstHashedSymbol];\n";
+    out << "            if (((chainHash | 1) == (hash | 1)) && (std::strcmp(m_strings + m_symbols[symbolIndex].st_name, name) == 0)) {\n";
+    out << "                return resolve(symbolIndex);\n";
+    out << "            }\n";
+    out << "            if (chainHash & 1) { return nullptr; }\n";
+    out << "            ++symbolIndex;\n";
+    out << "        }\n";
+    out << "    }\n";
+    out << "private:\n";
+    out << "    [[nodiscard]] DWG_FunctionPointer resolve(const std::uint32_t symbolIndex) const {\n";
+    out << "        const ElfW(Sym) &symbol = m_symbols[symbolIndex];\n";
+    out << "        const unsigned binding = symbol.st_info >> 4;\n";
+    out << "        const unsigned type = symbol.st_info & 0xF;\n";
+    out << "        if ((symbol.st_shndx == SHN_UNDEF) || ((binding != STB_GLOBAL) && (binding != STB_WEAK) && (binding != STB_GNU_UNIQUE))) { return nullptr; }\n";
+    // An ifunc has to be called to get the address, dlsym() knows how to do that on this platform.
+    out << "        if ((type != STT_FUNC) && (type != STT_NOTYPE)) { return nullptr; }\n";
+    // dlsym() only finds the default version of a symbol by its plain name.
+    out << "        if (m_versions && ((m_versions[symbolIndex] & 0x8000) || ((m_versions[symbolIndex] & 0x7FFF) == 0))) { return nullptr; }\n";
+    out << "        return reinterpret_cast<DWG_FunctionPointer>(m_base + symbol.st_value);\n";
+    out << "    }\n";
+    out << "    ElfW(Addr) m_base = 0;\n";
+    out << "    const ElfW(Sym) *m_symbols = nullptr;\n";
+    out << "    const char *m_strings = nullptr;\n";
+    out << "    const ElfW(Half) *m_versions = nullptr;\n";
+    out << "    const ElfW(Addr) *m_bloom = nullptr;\n";
+    out << "    const std::uint32_t *m_buckets = nullptr;\n";
+    out << "    const std::uint32_t *m_chain = nullptr;\n";
+    out << "    std::uint32_t m_bucketCount = 0;\n";
+    out << "    std::uint32_t m_firstHashedSymbol = 0;\n";
+    out << "    std::uint32_t m_bloomMask = 0;\n";
+    out << "    std::uint32_t m_bloomShift = 0;\n";
+    out << "};\n";
+    out << "#else\n";
+    out << "struct DWG_DirectLookup { explicit DWG_DirectLookup(const DWG_LibraryHandle) {} };\n";
+    out << "#endif\n";
+    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_FindSymbol(const DWG_DirectLookup &lookup, const DWG_LibraryHandle library, const std::uint32_t index) {\n";
+    out << "#ifdef DWG_HAS_DIRECT_LOOKUP\n";
+    out << "    if (const auto symbol = lookup.find(index)) { return symbol; }\n";
+    out << "#else\n";
+    out << "    static_cast<void>(lookup);\n";
+    out << "#endif\n";
+    out << "    return ::DWG_GetProcAddress(library, &DWG_SymbolNames[DWG_SymbolNameOffsets[index]]);\n";
+    out << "}\n";
+}
+
+// The build-id of the library keys the files which describe it, so that they're never used with another build.
+static inline void writeLibraryImage(OutputBuffer &out)
+{
+    out << "#if defined(__linux__) && defined(__ELF__) && !defined(__ANDROID__)\n";
+    out << "#  define DWG_HAS_LIBRARY_IMAGE\n";
+    out << "#  include <algorithm>\n";
+    out << "#  include <cstdlib>\n";
+    out << "#  include <cstring>\n";
+    out << "#  include <link.h>\n";
+    out << "#  include <sys/stat.h>\n";
+    out << "struct DWG_LibraryImage {\n";
+    out << "    ElfW(Addr) base = 0;\n";
+    out << "    ElfW(Addr) size = 0;\n";
+    out << "    std::string buildId = {};\n";
+    out << "};\n";
+    // The build-id is in a PT_NOTE segment of the library, we find the library among the loaded objects by its dynamic section.
+    out << "[[nodiscard]] static inline bool DWG_GetLibraryImage(const DWG_LibraryHandle library, DWG_LibraryImage &imageOut) {\n";
+    out << "    struct link_map *map = nullptr;\n";
+    out << "    if ((::dlinfo(library, RTLD_DI_LINKMAP, &map) != 0) || !map) { return false; }\n";
+    out << "    imageOut.base = map->l_addr;\n";
+    out << "    struct Context { const struct link_map *map = nullptr; DWG_LibraryImage &image; } context = { map, imageOut };\n";
+    out << "    ::dl_iterate_phdr([](struct dl_phdr_info *info, std::size_t, void *data) -> int {\n";
+    out << "        auto &context = *static_cast<Context *>(data);\n";
+    out << "        if (info->dlpi_addr != context.map->l_addr) { return 0; }\n";
+    out << "        bool found = false;\n";
+    out << "        for (ElfW(Half) index = 0; index != info->dlpi_phnum; ++index) {\n";
+    out << "            const ElfW(Phdr) &header = info->dlpi_phdr[index];\n";
+    out << "            found = found || ((header.p_type == PT_DYNAMIC) && ((info->dlpi_addr + header.p_vaddr) == reinterpret_cast<ElfW(Addr)>(context.map->l_ld)));\n";
+    out << "        }\n";
+    out << "        if (!found) { return 0; }\n";
+    out << "        for (ElfW(Half) index = 0; index != info->dlpi_phnum; ++index) {\n";
+    out << "            const ElfW(Phdr) &header = info->dlpi_phdr[index];\n";
+    out << "            if (header.p_type == PT_LOAD) {\n";
+    out << "                context.image.size = std::max<ElfW(Addr)>(context.image.size, header.p_vaddr + header.p_memsz);\n";
+    out << "                continue;\n";
+    out << "            }\n";
+    out << "            if ((header.p_type != PT_NOTE) || !context.image.buildId.empty()) { continue; }\n";
+    // Every note is: u32 name size, u32 description size, u32 type, the name and the description, both padded to the segment alignment.
+    out << "            const std::size_t alignment = (header.p_align == 8) ? 8 : 4;\n";
+    out << "            const auto align = [alignment](const std::size_t size) -> std::size_t { return (size + alignment - 1) & ~(alignment - 1); };\n";
+    out << "            const char *note = reinterpret_cast<const char *>(info->dlpi_addr + header.p_vaddr);\n";
+    out << "            const char * const end = note + header.p_memsz;\n";
+    out << "            while ((end - note) >= 12) {\n";
+    out << "                std::uint32_t fields[3] = {};\n";
+    out << "                std::memcpy(fields, note, sizeof(fields));\n";
+    out << "                const char * const name = note + 12;\n";
+    out << "                const char * const description = name + align(fields[0]);\n";
+    out << "                const char * const next = description + align(fields[1]);\n";
+    out << "                if ((next > end) || (next <= note)) { break; }\n";
+    out << "                if ((fields[2] == NT_GNU_BUILD_ID) && (fields[0] == 4) && (std::memcmp(name, \"GNU\", 4) == 0)) {\n";
+    out << "                    static constexpr const char digits[] = \"0123456789abcdef\";\n";
+    out << "                    for (std::uint32_t byte = 0; byte != fields[1]; ++byte) {\n";
+    out << "                        context.image.buildId += digits[std::uint8_t(description[byte]) >> 4];\n";
+    out << "                        context.image.buildId += digits[std::uint8_t(description[byte]) & 0xF];\n";
+    out << "                    }\n";
+    out << "                    break;\n";
+    out << "                }\n";
+    out << "                note = next;\n";
+    out << "            }\n";
+    out << "        }\n";
+    out << "        return 1;\n";
+    out << "    }, &context);\n";
+    out << "    return !imageOut.buildId.empty() && (imageOut.size > 0);\n";
+    out << "}\n";
+    // Set but empty disables the files which live there.
+    out << "[[nodiscard]] static inline std::string DWG_GetCacheDirectory(const char * const variable) {\n";
+    out << "    std::string directory = {};\n";
+    out << "    if (const char * const customDirectory = std::getenv(variable)) {\n";
+    out << "        directory = customDirectory;\n";
+    out << "    } else if (const char * const cacheHome = std::getenv(\"XDG_CACHE_HOME\"); cacheHome && *cacheHome) {\n";
+    out << "        directory = std::string(cacheHome) + \"/dwg\";\n";
+    out << "    } else if (const char * const home = std::getenv(\"HOME\"); home && *home) {\n";
+    out << "        ::mkdir((std::string(home) + \"/.cache\").c_str(), 0700);\n";
+    out << "        directory = std::string(home) + \"/.cache/dwg\";\n";
+    out << "    }\n";
+    out << "    if (!directory.empty()) { ::mkdir(directory.c_str(), 0700); }\n";
+    out << "    return directory;\n";
+    out << "}\n";
+    out << "#endif\n";
+}
+
+// Remembers where the symbols are, relative to the load base of the library, in a file keyed by the GNU build-id
+// of the library and by the wrapped names, so the next startups fill the whole table by adding the base, without
+// any string lookup. A rebuilt library has a different build-id, so it never meets the offsets of the old one.
+// The symbols which aren't inside the library itself (ifuncs, the ones of its dependencies) are always resolved
+// by dlsym(), and no offset ever points outside of the library image, whatever the file says.
+static inline void writeOffsetCache(OutputBuffer &out, const GeneratorOptions &options, const Headers &headers)
+{
+    std::uint64_t namesHash = hashString({});
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            namesHash = hashString(function.name, namesHash);
+        }
+    }
+    std::array<char, 16> namesHashBuffer = {};
+    const auto namesHashEnd = std::to_chars(namesHashBuffer.data(), namesHashBuffer.data() + namesHashBuffer.size(), namesHash, 16).ptr;
+    const std::string_view namesHashHex(namesHashBuffer.data(), std::size_t(namesHashEnd - namesHashBuffer.data()));
+    out << "#ifdef DWG_HAS_DIRECT_LOOKUP\n";
+    out << "#  include <cstdio>\n";
+    out << "#  include <memory>\n";
+    out << "#  include <unistd.h>\n";
+    out << "class DWG_OffsetCache {\n";
+    out << "public:\n";
+    out << "    DWG_OffsetCache(const DWG_DirectLookup &lookup, const DWG_LibraryHandle library) : m_lookup(lookup), m_library(library), m_offsets(new std::uint64_t[DWG_SymbolCount]) {\n";
+    out << "        DWG_LibraryImage image = {};\n";
+    out << "        if (!::DWG_GetLibraryImage(library, image)) { return; }\n";
+    out << "        m_base = image.base;\n";
+    out << "        m_imageSize = image.size;\n";
+    out << "        const std::string directory = ::DWG_GetCacheDirectory(\"DWG_OFFSET_CACHE_DIR\");\n";
+    out << "        if (directory.empty()) { return; }\n";
+    out << "        m_path = directory + \"/" << toIdentifier(options.dllFileName) << "-\" + image.buildId + \"-" << namesHashHex << ".dwgo\";\n";
+    out << "        m_loaded = load();\n";
+    out << "    }\n";
+    out << "    [[nodiscard]] DWG_FunctionPointer find(const std::uint32_t index) {\n";
+    out << "        if (m_loaded) {\n";
+    out << "            const std::uint64_t offset = m_offsets[index];\n";
+    out << "            if (offset == kMissing) { return nullptr; }\n";
+    out << "            if (offset == kLookUp) { return ::DWG_GetProcAddress(m_library, &DWG_SymbolNames[DWG_SymbolNameOffsets[index]]); }\n";
+    out << "            return reinterpret_cast<DWG_FunctionPointer>(m_base + offset);\n";
+    out << "        }\n";
+    out << "        if (const auto symbol = m_lookup.find(index)) {\n";
+    out << "            const ElfW(Addr) offset = reinterpret_cast<ElfW(Addr)>(symbol) - m_base;\n";
+    out << "            m_offsets[index] = (offset < m_imageSize) ? offset : kLookUp;\n";
+    out << "            return symbol;\n";
+    out << "        }\n";
+    out << "        const auto symbol = ::DWG_GetProcAddress(m_library, &DWG_SymbolNames[DWG_SymbolNameOffsets[index]]);\n";
+    out << "        m_offsets[index] = symbol ? kLookUp : kMissing;\n";
+    out << "        return symbol;\n";
+    out << "    }\n";
+    // Written next to its final location first and then renamed, so that a concurrent startup never reads a partial file.
+    out << "    void save() const {\n";
+    out << "        if (m_loaded || m_path.empty()) { return; }\n";
+    out << "        const std::string tempPath = m_path + \".tmp\" + std::to_string(::getpid());\n";
+    out << "        std::FILE * const file = std::fopen(tempPath.c_str(), \"wb\");\n";
+    out << "        if (!file) { return; }\n";
+    out << "        const std::uint64_t header[3] = { kMagic, kNamesHash, DWG_SymbolCount };\n";
+    out << "        const bool written = (std::fwrite(header, sizeof(header), 1, file) == 1) && (std::fwrite(m_offsets.get(), sizeof(std::uint64_t), DWG_SymbolCount, file) == DWG_SymbolCount);\n";
+    out << "        if ((std::fclose(file) != 0) || !written || (std::rename(tempPath.c_str(), m_path.c_str()) != 0)) { std::remove(tempPath.c_str()); }\n";
+    out << "    }\n";
+    out << "private:\n";
+    out << "    static constexpr const std::uint64_t kMagic = 0x000000014F475744ull; // \"DWGO\", version 1.\n";
+    out << "    static constexpr const std::uint64_t kNamesHash = 0x" << namesHashHex << "ull;\n";
+    out << "    static constexpr const std::uint64_t kMissing = ~std::uint64_t(0);\n";
+    out << "    static constexpr const std::uint64_t kLookUp = ~std::uint64_t(0) - 1;\n";
+    out << "    [[nodiscard]] bool load() {\n";
+    out << "        std::FILE * const file = std::fopen(m_path.c_str(), \"rb\");\n";
+    out << "        if (!file) { return false; }\n";
+    out << "        std::uint64_t header[3] = {};\n";
+    out << "        const bool valid = (std::fread(header, sizeof(header), 1, file) == 1) && (header[0] == kMagic) && (header[1] == kNamesHash) && (header[2] == DWG_SymbolCount)\n";
+    out << "            && (std::fread(m_offsets.get(), sizeof(std::uint64_t), DWG_SymbolCount, file) == DWG_SymbolCount);\n";
+    out << "        std::fclose(file);\n";
+    out << "        if (!valid) { return false; }\n";
+    out << "        for (std::uint32_t index = 0; index != DWG_SymbolCount; ++index) {\n";
+    out << "            if ((m_offsets[index] < kLookUp) && (m_offsets[index] >= m_imageSize)) { return false; }\n";
+    out << "        }\n";
+    out << "        return true;\n";
+    out << "    }\n";
+    out << "    const DWG_DirectLookup &m_lookup;\n";
+    out << "    const DWG_LibraryHandle m_library = nullptr;\n";
+    out << "    const std::unique_ptr<std::uint64_t[]> m_offsets;\n";
+    out << "    ElfW(Addr) m_base = 0;\n";
+    out << "    ElfW(Addr) m_imageSize = 0;\n";
+    out << "    std::string m_path = {};\n";
+    out << "    bool m_loaded = false;\n";
+    out << "};\n";
+    out << "#else\n";
+    out << "class DWG_OffsetCache {\n";
+    out << "public:\n";
+    out << "    DWG_OffsetCache(const DWG_DirectLookup &lookup, const DWG_LibraryHandle library) : m_lookup(lookup), m_library(library) {}\n";
+    out << "    [[nodiscard]] DWG_FunctionPointer find(const std::uint32_t index) const { return ::DWG_FindSymbol(m_lookup, m_library, index); }\n";
+    out << "    void save() const {}\n";
+    out << "private:\n";
+    out << "    const DWG_DirectLookup &m_lookup;\n";
+    out << "    const DWG_LibraryHandle m_library = nullptr;\n";
+    out << "};\n";
+    out << "#endif\n";
+}
+
+// All the names are packed into one string table and referred to by offsets, which doesn't need
+// any relocation, and the resolved pointers live in one contiguous table, indexed by an enum.
+static inline void writeSymbolTable(OutputBuffer &out, const GeneratorOptions &options, const Headers &headers, const std::vector<std::size_t> &stubIndexes)
+{
+    out << "enum DWG_Symbol : std::uint32_t {\n";
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "    DWG_Symbol_" << function.name << ",\n";
+        }
+    }
+    out << "    DWG_SymbolCount\n";
+    out << "};\n";
+    out << "static constexpr const char DWG_SymbolNames[] =\n";
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "    \"" << function.name << "\\0\"\n";
+        }
+    }
+    out << "    ;\n";
+    out << "static constexpr const std::uint32_t DWG_SymbolNameOffsets[DWG_SymbolCount] = {\n";
+    std::size_t offset = 0;
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "    " << offset << ",\n";
+            offset += function.name.size() + 1;
+        }
+    }
+    out << "};\n";
+    std::string tableDefinition = "alignas(64) static DWG_FunctionPointer DWG_SymbolTable[DWG_SymbolCount]";
+    if (options.exportSymbolTable && (options.binding == BindingMode::Table)) {
+        out << "extern \"C\" {\n";
+        tableDefinition = "alignas(64) DWG_FunctionPointer " + exportedSymbolTableName(options) + "[DWG_SymbolCount]";
+    }
+    if (options.binding == BindingMode::Thunk) {
+        // The thunks refer to the table by its assembler name, so it must not be renamed or dropped by the compiler,
+        // and every slot always points to something callable, the missing symbols are redirected to the stub of their
+        // signature, which also fills in the result a large struct is returned through.
+        out << "#ifdef DWG_HAS_THUNKS\n";
+        out << "static inline void DWG_API DWG_WritePerfMap();\n";
+        out << "alignas(64) [[gnu::visibility(\"hidden\"), gnu::used]] DWG_FunctionPointer DWG_SymbolTable[DWG_SymbolCount] __asm__(DWG_THUNK_TABLE) = {\n";
+        for (auto &&stubIndex : std::as_const(stubIndexes)) {
+            out << "    reinterpret_cast<DWG_FunctionPointer>(&::DWG_MissingSymbolStub" << stubIndex << "),\n";
+        }
+        out << "};\n";
+        out << "#else\n";
+        out << "alignas(64) static DWG_FunctionPointer DWG_SymbolTable[DWG_SymbolCount] = {};\n";
+        out << "#endif\n";
+    } else if (!stubIndexes.empty()) {
+        out << tableDefinition << " = {\n";
+        for (auto &&stubIndex : std::as_const(stubIndexes)) {
+            if (stubIndex == std::string::npos) {
+                out << "    nullptr,\n";
+            } else {
+                out << "    reinterpret_cast<DWG_FunctionPointer>(&::DWG_MissingSymbolStub" << stubIndex << "),\n";
+            }
+        }
+        out << "};\n";
+    } else {
+        out << tableDefinition << " = {};\n";
+    }
+    if (options.exportSymbolTable && (options.binding == BindingMode::Table)) {
+        out << "}\n";
+        out << "static constexpr DWG_FunctionPointer (&DWG_SymbolTable)[DWG_SymbolCount] = ::" << exportedSymbolTableName(options) << ";\n";
+    }
+    std::string_view findSymbol = "::DWG_GetProcAddress(library, &DWG_SymbolNames[DWG_SymbolNameOffsets[index]])";
+    if (options.directLookup) {
+        writeDirectLookup(out, headers);
+        findSymbol = "::DWG_FindSymbol(lookup, library, index)";
+    }
+    if (options.offsetCache) {
+        writeOffsetCache(out, options, headers);
+        findSymbol = "cache.find(index)";
+    }
+    out << "static inline void DWG_API DWG_ResolveSymbolTable() {\n";
+    // The preloader calls it right after it loaded the library, it must not wait for itself.
+    out << "    if (const auto library = " << (options.preload ? "DWG_Library" : "::DWG_TryGetLibrary()") << ") {\n";
+    if (options.directLookup) {
+        out << "        const DWG_DirectLookup lookup(library);\n";
+    }
+    if (options.offsetCache) {
+        out << "        DWG_OffsetCache cache(lookup, library);\n";
+    }
+    out << "        for (std::uint32_t index = 0; index != DWG_SymbolCount; ++index) {\n";
+    if (!stubIndexes.empty()) {
+        // Keep the stub in the slot if the symbol is missing.
+        out << "            if (const auto symbol = " << findSymbol << ") { DWG_SymbolTable[index] = symbol; }\n";
+    } else {
+        out << "            DWG_SymbolTable[index] = " << findSymbol << ";\n";
+    }
+    out << "        }\n";
+    if (options.offsetCache) {
+        out << "        cache.save();\n";
+    }
+    out << "    }\n";
+    if (options.binding == BindingMode::Thunk) {
+        out << "#ifdef DWG_HAS_THUNKS\n";
+        out << "    ::DWG_WritePerfMap();\n";
+        out << "#endif\n";
+    }
+    out << "}\n";
+    if (options.preload) {
+        return;
+    }
+    // Resolve the table before the static initializers of the other translation units run, so that they can use the wrappers, too.
+    out << "#if defined(__GNUC__) || defined(__clang__)\n";
+    out << "[[gnu::constructor(101)]] static void DWG_InitializeSymbolTable() { ::DWG_ResolveSymbolTable(); }\n";
+    out << "#else\n";
+    out << "#  ifdef _MSC_VER\n";
+    out << "#    pragma init_seg(lib)\n";
+    out << "#  endif\n";
+    out << "static const bool DWG_SymbolTableInitialized = (::DWG_ResolveSymbolTable(), true);\n";
+    out << "#endif\n";
+}
+
+static inline void writeLibraryFileName(OutputBuffer &out, const GeneratorOptions &options)
+{
+    out << "#ifdef WIN32\n";
+    out << "        \"" << options.dllFileName << ".dll\"\n";
+    out << "#elif defined(__APPLE__)\n";
+    out << "        \"lib" << options.dllFileName << ".dylib\"\n";
+    out << "#else\n";
+    out << "        \"lib" << options.dllFileName << ".so\"\n";
+    out << "#endif\n";
+}
+
+// The library is loaded once, by whoever comes first: the background thread started by DWG_Preload() or the first
+// wrapper call, which then does it on its own thread. Everybody else sleeps on the load state (a futex) until it's
+// done, once it is, waiting costs a single acquire load. Waiting can't deadlock, since the background thread is only
+// ever started outside of the loader lock, see writePreloader().
+static inline void writeLibraryLoader(OutputBuffer &out)
+{
+    out << "#include <atomic>\n";
+    out << "#include <cstdint>\n";
+    out << "#include <thread>\n";
+    out << "#ifdef __linux__\n";
+    out << "#  include <fcntl.h>\n";
+    out << "#  include <link.h>\n";
+    out << "#  include <linux/futex.h>\n";
+    out << "#  include <sys/syscall.h>\n";
+    out << "#  include <unistd.h>\n";
+    out << "#endif\n";
+    out << "static DWG_LibraryHandle DWG_Library = nullptr;\n";
+    out << "enum DWG_LoadStates : std::uint32_t { DWG_NotLoaded, DWG_Loading, DWG_Loaded };\n";
+    out << "static std::atomic<std::uint32_t> DWG_LoadState = DWG_NotLoaded;\n";
+    out << "static inline void DWG_API DWG_Load();\n";
+    out << "static inline void DWG_API DWG_WaitForLibrary() {\n";
+    out << "    std::uint32_t state = DWG_LoadState.load(std::memory_order_acquire);\n";
+    out << "    if (state == DWG_Loaded) { return; }\n";
+    // Nobody started loading it yet (no preload was started, or it's a shared library and its host didn't start
+    // it yet): load it right here, this is also safe under the loader lock, since dlopen() takes it recursively.
+    out << "    if ((state == DWG_NotLoaded) && DWG_LoadState.compare_exchange_strong(state, DWG_Loading, std::memory_order_acq_rel)) {\n";
+    out << "        ::DWG_Load();\n";
+    out << "        return;\n";
+    out << "    }\n";
+    // The load is in progress: wait for it instead of doing the same work twice.
+    out << "    while (DWG_LoadState.load(std::memory_order_acquire) != DWG_Loaded) {\n";
+    out << "#if defined(__cpp_lib_atomic_wait)\n";
+    out << "        DWG_LoadState.wait(DWG_Loading, std::memory_order_acquire);\n";
+    out << "#elif defined(__linux__)\n";
+    out << "        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&DWG_LoadState), FUTEX_WAIT_PRIVATE, std::uint32_t(DWG_Loading), nullptr, nullptr, 0);\n";
+    out << "#else\n";
+    out << "        std::this_thread::yield();\n";
+    out << "#endif\n";
+    out << "    }\n";
+    out << "}\n";
+    out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_TryGetLibrary() {\n";
+    out << "    ::DWG_WaitForLibrary();\n";
+    out << "    return DWG_Library;\n";
+    out << "}\n";
+}
+
+// Runs on the thread which won the race to load the library: loads it, asks the kernel to read the rest of the file
+// in the background (so that the first calls don't fault the code pages in one by one), resolves the symbol table
+// and finally wakes up everybody who's waiting.
+// The background thread is started automatically in executables only. The static initializers of a shared library
+// run under the loader lock (dlopen(), DllMain), so the thread would block on it in its own dlopen() while a wrapper
+// called by one of them would wait for the thread, a shared library calls DWG_Preload() once it's loaded instead.
+static inline void writePreloader(OutputBuffer &out, const GeneratorOptions &options)
+{
+    out << "static inline void DWG_API DWG_ReadAhead(const DWG_LibraryHandle library) {\n";
+    out << "#ifdef __linux__\n";
+    out << "    struct link_map *map = nullptr;\n";
+    out << "    if ((::dlinfo(library, RTLD_DI_LINKMAP, &map) != 0) || !map || !map->l_name || !*map->l_name) { return; }\n";
+    out << "    const int file = ::open(map->l_name, O_RDONLY | O_CLOEXEC);\n";
+    out << "    if (file < 0) { return; }\n";
+    out << "    ::posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);\n";
+    out << "    ::close(file);\n";
+    out << "#else\n";
+    out << "    static_cast<void>(library);\n";
+    out << "#endif\n";
+    out << "}\n";
+    out << "static inline void DWG_API DWG_Load() {\n";
+    out << "    DWG_Library = ::DWG_LoadLibrary(\n";
+    writeLibraryFileName(out, options);
+    out << "        );\n";
+    out << "    if (DWG_Library) {\n";
+    if (options.pageTraceSeconds > 0) {
+        // The whole file is only read ahead by the run which records the trace.
+        out << "        if (!::DWG_StartPageTrace(DWG_Library)) { ::DWG_ReadAhead(DWG_Library); }\n";
+    } else {
+        out << "        ::DWG_ReadAhead(DWG_Library);\n";
+    }
+    if (usesSymbolTable(options.binding)) {
+        out << "        ::DWG_ResolveSymbolTable();\n";
+    }
+    out << "    }\n";
+    out << "    DWG_LoadState.store(DWG_Loaded, std::memory_order_release);\n";
+    out << "#if defined(__cpp_lib_atomic_wait)\n";
+    out << "    DWG_LoadState.notify_all();\n";
+    out << "#elif defined(__linux__)\n";
+    out << "    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&DWG_LoadState), FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, nullptr, nullptr, 0);\n";
+    out << "#endif\n";
+    out << "}\n";
+    std::string_view threadFunction = "&::DWG_Load";
+    if (options.pageTraceSeconds > 0) {
+        // Only the background thread waits for the end of the trace window, a caller which loads the library itself doesn't.
+        out << "static inline void DWG_API DWG_LoadAndTrace() {\n";
+        out << "    ::DWG_Load();\n";
+        out << "    if (DWG_PageTraceRecording.load(std::memory_order_acquire)) {\n";
+        out << "        std::this_thread::sleep_for(std::chrono::seconds(DWG_PageTraceSeconds));\n";
+        out << "        ::DWG_SavePageTrace();\n";
+        out << "    }\n";
+        out << "}\n";
+        threadFunction = "&::DWG_LoadAndTrace";
+    }
+    out << "extern \"C\" void DWG_Preload() {\n";
+    out << "    std::uint32_t state = DWG_NotLoaded;\n";
+    out << "    if (!DWG_LoadState.compare_exchange_strong(state, DWG_Loading, std::memory_order_acq_rel)) { return; }\n";
+    out << "#if defined(__cpp_exceptions) || defined(_CPPUNWIND)\n";
+    out << "    try {\n";
+    out << "        std::thread(" << threadFunction << ").detach();\n";
+    out << "    } catch (...) {\n";
+    out << "        ::DWG_Load();\n";
+    out << "    }\n";
+    out << "#else\n";
+    out << "    std::thread(" << threadFunction << ").detach();\n";
+    out << "#endif\n";
+    out << "}\n";
+    out << "#if !defined(DWG_NO_AUTO_PRELOAD) && !defined(_WINDLL) && (!defined(__PIC__) || defined(__PIE__))\n";
+    out << "#  if defined(__GNUC__) || defined(__clang__)\n";
+    out << "[[gnu::constructor(101)]] static void DWG_StartPreload() { ::DWG_Preload(); }\n";
+    out << "#  else\n";
+    out << "#    ifdef _MSC_VER\n";
+    out << "#      pragma init_seg(lib)\n";
+    out << "#    endif\n";
+    out << "static const bool DWG_PreloadStarted = (::DWG_Preload(), true);\n";
+    out << "#  endif\n";
+    out << "#endif\n";
+}
+
+// The first run of a build of the library records which wrapped functions were called in the first few seconds,
+// and saves the pages of the library they occupy. Every later run asks the kernel to read exactly those pages
+// right after the library was loaded, instead of reading the whole file ahead or faulting them in one by one.
+static inline void writePageTrace(OutputBuffer &out, const GeneratorOptions &options, const std::size_t functionCount)
+{
+    out << "#include <chrono>\n";
+    out << "static std::atomic<bool> DWG_PageTraceRecording = false;\n";
+    out << "#ifdef DWG_HAS_LIBRARY_IMAGE\n";
+    out << "#  include <cstdio>\n";
+    out << "#  include <vector>\n";
+    out << "#  include <sys/mman.h>\n";
+    out << "static constexpr const std::uint64_t DWG_PageTraceMagic = 0x0000000150475744ull; // \"DWGP\", version 1.\n";
+    out << "static constexpr const std::uint32_t DWG_PageTraceSeconds = " << options.pageTraceSeconds << ";\n";
+    out << "static std::atomic<DWG_FunctionPointer> DWG_PageTraceCalls[" << functionCount << "];\n";
+    // Plain data only, it's still used by the exit-time save after the other static objects are gone.
+    out << "static struct { ElfW(Addr) base; ElfW(Addr) size; char path[4096]; } DWG_PageTrace = {};\n";
+    out << "static inline void DWG_API DWG_TraceCall(const std::uint32_t index, const DWG_FunctionPointer function) {\n";
+    out << "    if (DWG_PageTraceRecording.load(std::memory_order_relaxed)) { DWG_PageTraceCalls[index].store(function, std::memory_order_relaxed); }\n";
+    out << "}\n";
+    // Only the entry of a function is known, its symbol tells its size, a function can span several pages.
+    out << "static inline void DWG_API DWG_SavePageTrace() {\n";
+    out << "    if (!DWG_PageTraceRecording.exchange(false, std::memory_order_acq_rel)) { return; }\n";
+    out << "    const ElfW(Addr) pageSize = ElfW(Addr)(::sysconf(_SC_PAGESIZE));\n";
+    out << "    std::vector<std::uint64_t> pages = {};\n";
+    out << "    for (auto &&call : DWG_PageTraceCalls) {\n";
+    out << "        const auto address = reinterpret_cast<ElfW(Addr)>(call.load(std::memory_order_relaxed));\n";
+    // Not called, missing, or a stub of ours.
+    out << "        if ((address < DWG_PageTrace.base) || ((address - DWG_PageTrace.base) >= DWG_PageTrace.size)) { continue; }\n";
+    out << "        Dl_info info = {};\n";
+    out << "        void *entry = nullptr;\n";
+    out << "        const bool found = (::dladdr1(reinterpret_cast<void *>(address), &info, &entry, RTLD_DL_SYMENT) != 0);\n";
+    out << "        const auto symbol = static_cast<const ElfW(Sym) *>(entry);\n";
+    out << "        const bool sized = found && symbol && (symbol->st_size > 0);\n";
+    out << "        const ElfW(Addr) first = address - DWG_PageTrace.base;\n";
+    out << "        const ElfW(Addr) last = std::min<ElfW(Addr)>(first + (sized ? symbol->st_size : 1), DWG_PageTrace.size) - 1;\n";
+    out << "        for (ElfW(Addr) page = first & ~(pageSize - 1); page <= last; page += pageSize) { pages.push_back(page); }\n";
+    out << "    }\n";
+    out << "    std::sort(pages.begin(), pages.end());\n";
+    out << "    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());\n";
+    out << "    const std::string tempPath = std::string(DWG_PageTrace.path) + \".tmp\" + std::to_string(::getpid());\n";
+    out << "    std::FILE * const file = std::fopen(tempPath.c_str(), \"wb\");\n";
+    out << "    if (!file) { return; }\n";
+    out << "    const std::uint64_t header[2] = { DWG_PageTraceMagic, pages.size() };\n";
+    out << "    const bool written = (std::fwrite(header, sizeof(header), 1, file) == 1) && (std::fwrite(pages.data(), sizeof(std::uint64_t), pages.size(), file) == pages.size());\n";
+    out << "    if ((std::fclose(file) != 0) || !written || (std::rename(tempPath.c_str(), DWG_PageTrace.path) != 0)) { std::remove(tempPath.c_str()); }\n";
+    out << "}\n";
+    // The adjacent pages are advised in one go, a trace which doesn't fit this image (or this page size) is recorded again.
+    out << "[[nodiscard]] static inline bool DWG_API DWG_PrefetchPages(const char * const path, const DWG_LibraryImage &image) {\n";
+    out << "    std::FILE * const file = std::fopen(path, \"rb\");\n";
+    out << "    if (!file) { return false; }\n";
+    out << "    const ElfW(Addr) pageSize = ElfW(Addr)(::sysconf(_SC_PAGESIZE));\n";
+    out << "    std::uint64_t header[2] = {};\n";
+    out << "    std::vector<std::uint64_t> pages = {};\n";
+    out << "    bool valid = (std::fread(header, sizeof(header), 1, file) == 1) && (header[0] == DWG_PageTraceMagic) && (header[1] <= (image.size / pageSize + 1));\n";
+    out << "    if (valid) {\n";
+    out << "        pages.resize(std::size_t(header[1]));\n";
+    out << "        valid = (std::fread(pages.data(), sizeof(std::uint64_t), pages.size(), file) == pages.size());\n";
+    out << "    }\n";
+    out << "    std::fclose(file);\n";
+    out << "    for (std::size_t index = 0; valid && (index != pages.size()); ++index) {\n";
+    out << "        valid = ((pages[index] % pageSize) == 0) && (pages[index] < image.size) && ((index == 0) || (pages[index - 1] < pages[index]));\n";
+    out << "    }\n";
+    out << "    if (!valid) { return false; }\n";
+    out << "    for (std::size_t index = 0; index != pages.size();) {\n";
+    out << "        const std::uint64_t start = pages[index];\n";
+    out << "        std::uint64_t end = start + pageSize;\n";
+    out << "        while ((++index != pages.size()) && (pages[index] == end)) { end += pageSize; }\n";
+    out << "        ::madvise(reinterpret_cast<void *>(image.base + start), std::size_t(end - start), MADV_WILLNEED);\n";
+    out << "    }\n";
+    out << "    return true;\n";
+    out << "}\n";
+    out << "[[nodiscard]] static inline bool DWG_API DWG_StartPageTrace(const DWG_LibraryHandle library) {\n";
+    out << "    DWG_LibraryImage image = {};\n";
+    out << "    if (!::DWG_GetLibraryImage(library, image)) { return false; }\n";
+    out << "    const std::string directory = ::DWG_GetCacheDirectory(\"DWG_PAGE_TRACE_DIR\");\n";
+    out << "    const std::string path = directory + \"/" << toIdentifier(options.dllFileName) << "-\" + image.buildId + \".dwgp\";\n";
+    out << "    if (directory.empty() || (path.size() >= sizeof(DWG_PageTrace.path))) { return false; }\n";
+    out << "    if (::DWG_PrefetchPages(path.c_str(), image)) { return true; }\n";
+    out << "    DWG_PageTrace.base = image.base;\n";
+    out << "    DWG_PageTrace.size = image.size;\n";
+    out << "    std::memcpy(DWG_PageTrace.path, path.c_str(), path.size() + 1);\n";
+    out << "    DWG_PageTraceRecording.store(true, std::memory_order_release);\n";
+    out << "    return false;\n";
+    out << "}\n";
+    // Saves what was recorded so far if the process ends before the trace window does.
+    out << "static const struct DWG_PageTraceSaver { ~DWG_PageTraceSaver() { ::DWG_SavePageTrace(); } } DWG_PageTraceExitSaver = {};\n";
+    out << "#else\n";
+    out << "static constexpr const std::uint32_t DWG_PageTraceSeconds = 0;\n";
+    out << "static inline void DWG_API DWG_TraceCall(const std::uint32_t, const DWG_FunctionPointer) {}\n";
+    out << "static inline void DWG_API DWG_SavePageTrace() {}\n";
+    out << "[[nodiscard]] static inline bool DWG_API DWG_StartPageTrace(const DWG_LibraryHandle) { return false; }\n";
+    out << "#endif\n";
+}
+
+// The thunks jump straight to the real function through its table slot, without touching any argument register
+// or the stack, so they work for any signature, including the variadic ones and the large structs passed by value.
+static inline void writeThunkPreamble(OutputBuffer &out, const GeneratorOptions &options)
+{
+    out << "#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))\n";
+    out << "#  define DWG_HAS_THUNKS\n";
+    out << "#  include <cstdio>\n";
+    out << "#  include <cstdlib>\n";
+    out << "#  include <unistd.h>\n";
+    out << "#  define DWG_THUNK_TABLE \"DWG_" << toIdentifier(options.dllFileName) << "_SymbolTable\"\n";
+    // Every thunk is padded to 16 bytes, which is also what we report in the perf map.
+    out << "#  define DWG_THUNK_SIZE 16\n";
+    out << "#  define DWG_THUNK_BEGIN(name) \".text\\n.globl \" #name \"\\n.type \" #name \", @function\\n.p2align 4\\n\" #name \":\\n\"\n";
+    out << "#  define DWG_THUNK_END(name) \".size \" #name \", .-\" #name \"\\n\"\n";
+    out << "#  ifdef __x86_64__\n";
+    out << "#    ifdef __CET__\n";
+    out << "#      define DWG_THUNK_LANDING_PAD \"endbr64\\n\"\n";
+    out << "#    else\n";
+    out << "#      define DWG_THUNK_LANDING_PAD \"\"\n";
+    out << "#    endif\n";
+    out << "#    define DWG_THUNK(name, index) __asm__(DWG_THUNK_BEGIN(name) DWG_THUNK_LANDING_PAD \"jmp *\" DWG_THUNK_TABLE \"+8*\" #index \"(%rip)\\n\" DWG_THUNK_END(name));\n";
+    out << "#  else\n";
+    out << "#    ifdef __ARM_FEATURE_BTI_DEFAULT\n";
+    out << "#      define DWG_THUNK_LANDING_PAD \"bti c\\n\"\n";
+    out << "#    else\n";
+    out << "#      define DWG_THUNK_LANDING_PAD \"\"\n";
+    out << "#    endif\n";
+    out << "#    define DWG_THUNK(name, index) __asm__(DWG_THUNK_BEGIN(name) DWG_THUNK_LANDING_PAD \"adrp x16, \" DWG_THUNK_TABLE \"+8*\" #index \"\\nldr x16, [x16, #:lo12:\" DWG_THUNK_TABLE \"+8*\" #index \"]\\nbr x16\\n\" DWG_THUNK_END(name));\n";
+    out << "#  endif\n";
+    out << "#endif\n";
+}
+
+static inline void writeThunks(OutputBuffer &out, const Headers &headers)
+{
+    std::size_t index = 0;
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "DWG_THUNK(" << function.name << ", " << index << ")\n";
+            ++index;
+        }
+    }
+    // "perf report" can symbolize the thunks through their ELF symbols already, the map is for the
+    // tools which only look at the perf map files, it's written when DWG_PERF_MAP is set at runtime.
+    out << "static inline void DWG_API DWG_WritePerfMap() {\n";
+    out << "    const char * const enabled = std::getenv(\"DWG_PERF_MAP\");\n";
+    out << "    if (!enabled || !*enabled) { return; }\n";
+    out << "    static const DWG_FunctionPointer thunks[DWG_SymbolCount] = {\n";
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "        reinterpret_cast<DWG_FunctionPointer>(&::" << function.name << "),\n";
+        }
+    }
+    out << "    };\n";
+    out << "    char path[64] = {};\n";
+    out << "    std::snprintf(path, sizeof(path), \"/tmp/perf-%d.map\", int(::getpid()));\n";
+    out << "    if (std::FILE * const file = std::fopen(path, \"a\")) {\n";
+    out << "        for (std::uint32_t index = 0; index != DWG_SymbolCount; ++index) {\n";
+    out << "            std::fprintf(file, \"%zx %x %s\\n\", reinterpret_cast<std::size_t>(thunks[index]), DWG_THUNK_SIZE, &DWG_SymbolNames[DWG_SymbolNameOffsets[index]]);\n";
+    out << "        }\n";
+    out << "        std::fclose(file);\n";
+    out << "    }\n";
+    out << "}\n";
+}
+
+enum class Temperature
+{
+    Cold, // Never called while the profile was recorded.
+    Warm,
+    Hot // One of the functions which together made 99% of the calls.
+};
+
+// The call counts an instrumented wrapper dumped with DWG_DumpStats(), in either format. The counts of the
+// functions which appear more than once are summed up, so the dumps of several processes can be concatenated.
+class CallProfile
+{
+public:
+    [[nodiscard]] inline bool load(const std::string &path) {
+        const MappedFile file(path);
+        if (!file.isValid()) {
+            std::cerr << "Failed to read the profile:" << path << std::endl;
+            return false;
+        }
+        const std::string_view text(file.data(), file.size());
+        const std::size_t first = text.find_first_not_of(" \t\r\n");
+        const bool parsed = ((first != std::string_view::npos) && (text[first] == '{')) ? parseJson(text) : parseText(text);
+        if (!parsed) {
+            std::cerr << "Invalid profile:" << path << std::endl;
+            return false;
+        }
+        std::vector<std::uint64_t> counts = {};
+        std::uint64_t totalCalls = 0;
+        for (auto &&[name, calls] : std::as_const(m_calls)) {
+            counts.push_back(calls);
+            totalCalls += calls;
+        }
+        // Nothing tells the functions apart, leave them all warm instead of moving every one of them out of the way.
+        if (totalCalls == 0) {
+            std::cerr << "The profile doesn't have any call, all the functions are treated as warm:" << path << std::endl;
+            return true;
+        }
+        std::sort(counts.begin(), counts.end(), std::greater<>());
+        std::uint64_t calls = 0;
+        for (auto &&count : std::as_const(counts)) {
+            calls += count;
+            m_hotCalls = count;
+            if (double(calls) >= (0.99 * double(totalCalls))) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] inline std::uint64_t calls(const std::string &name) const {
+        const auto it = m_calls.find(name);
+        return (it == m_calls.cend()) ? 0 : it->second;
+    }
+
+    [[nodiscard]] inline Temperature temperature(const std::string &name) const {
+        const std::uint64_t count = calls(name);
+        if (m_hotCalls == 0) {
+            return Temperature::Warm;
+        }
+        if (count == 0) {
+            return Temperature::Cold;
+        }
+        return (count >= m_hotCalls) ? Temperature::Hot : Temperature::Warm;
+    }
+
+private:
+    // "<name> <calls> <total nanoseconds> <buckets>...", the lines starting with '#' are comments.
+    [[nodiscard]] inline bool parseText(const std::string_view text) {
+        std::size_t position = 0;
+        while (position < text.size()) {
+            std::size_t end = text.find('\n', position);
+            if (end == std::string_view::npos) {
+                end = text.size();
+            }
+            const std::string_view line = text.substr(position, end - position);
+            position = end + 1;
+            const std::size_t nameBegin = line.find_first_not_of(" \t\r");
+            if ((nameBegin == std::string_view::npos) || (line[nameBegin] == '#')) {
+                continue;
+            }
+            const std::size_t nameEnd = line.find_first_of(" \t", nameBegin);
+            const std::size_t callsBegin = line.find_first_not_of(" \t", nameEnd);
+            if (callsBegin == std::string_view::npos) {
+                return false;
+            }
+            const std::size_t callsEnd = std::min(line.find_first_of(" \t\r", callsBegin), line.size());
+            std::uint64_t calls = 0;
+            if (!toUnsigned(line.substr(callsBegin, callsEnd - callsBegin), calls)) {
+                return false;
+            }
+            m_calls[std::string(line.substr(nameBegin, nameEnd - nameBegin))] += calls;
+        }
+        return true;
+    }
+
+    // Only what DWG_DumpStats() writes, every function is an object which starts with its name and its call count.
+    [[nodiscard]] inline bool parseJson(const std::string_view text) {
+        static constexpr const std::string_view nameKey = "\"name\":\"";
+        static constexpr const std::string_view callsKey = "\"calls\":";
+        std::size_t position = 0;
+        while ((position = text.find(nameKey, position)) != std::string_view::npos) {
+            const std::size_t nameBegin = position + nameKey.size();
+            const std::size_t nameEnd = text.find('"', nameBegin);
+            const std::size_t callsKeyBegin = text.find(callsKey, nameBegin);
+            if ((nameEnd == std::string_view::npos) || (callsKeyBegin == std::string_view::npos)) {
+                return false;
+            }
+            const std::size_t callsBegin = callsKeyBegin + callsKey.size();
+            const std::size_t callsEnd = std::min(text.find_first_not_of("0123456789", callsBegin), text.size());
+            std::uint64_t calls = 0;
+            if (!toUnsigned(text.substr(callsBegin, callsEnd - callsBegin), calls)) {
+                return false;
+            }
+            m_calls[std::string(text.substr(nameBegin, nameEnd - nameBegin))] += calls;
+            position = callsEnd;
+        }
+        return true;
+    }
+
+    std::map<std::string, std::uint64_t> m_calls = {};
+    std::uint64_t m_hotCalls = 0; // The call count of the least called hot function, 0 if the profile is empty.
+};
+
+// Every thread owns its own counters, the calls only do plain (relaxed) loads and stores on the cache lines
+// of the calling thread, the data of all the threads is only merged when the statistics are dumped.
+static inline void writeStatsRuntime(OutputBuffer &out, const Headers &headers)
+{
+    out << "#include <atomic>\n";
+    out << "#include <chrono>\n";
+    out << "#include <cstdio>\n";
+    out << "#include <cstdint>\n";
+    out << "static constexpr const char * const DWG_StatsNames[] = {\n";
+    std::size_t functionCount = 0;
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            out << "    \"" << function.name << "\",\n";
+            ++functionCount;
+        }
+    }
+    out << "};\n";
+    out << "static constexpr const std::uint32_t DWG_StatsFunctionCount = " << functionCount << ";\n";
+    // Bucket N counts the calls which took [2^(N-1), 2^N) nanoseconds, the last one also counts everything slower.
+    out << "static constexpr const std::uint32_t DWG_StatsBucketCount = 40;\n";
+    out << "struct alignas(64) DWG_FunctionStats {\n";
+    out << "    std::atomic<std::uint64_t> calls;\n";
+    out << "    std::atomic<std::uint64_t> nanoseconds;\n";
+    out << "    std::atomic<std::uint64_t> buckets[DWG_StatsBucketCount];\n";
+    out << "};\n";
+    out << "struct DWG_ThreadStats {\n";
+    out << "    std::atomic<DWG_FunctionStats *> functions[DWG_StatsFunctionCount];\n";
+    out << "    DWG_ThreadStats *next;\n";
+    out << "};\n";
+    // The data of a thread is never freed, so that the calls of the threads which have exited are still counted.
+    out << "static std::atomic<DWG_ThreadStats *> DWG_AllThreadStats = nullptr;\n";
+    out << "static thread_local DWG_ThreadStats *DWG_CurrentThreadStats = nullptr;\n";
+    out << "[[nodiscard]] static inline DWG_FunctionStats &DWG_GetFunctionStats(const std::uint32_t index) {\n";
+    out << "    DWG_ThreadStats *thread = DWG_CurrentThreadStats;\n";
+    out << "    if (!thread) {\n";
+    out << "        thread = new DWG_ThreadStats{};\n";
+    out << "        thread->next = DWG_AllThreadStats.load(std::memory_order_relaxed);\n";
+    out << "        while (!DWG_AllThreadStats.compare_exchange_weak(thread->next, thread, std::memory_order_release, std::memory_order_relaxed)) {}\n";
+    out << "        DWG_CurrentThreadStats = thread;\n";
+    out << "    }\n";
+    out << "    DWG_FunctionStats *stats = thread->functions[index].load(std::memory_order_relaxed);\n";
+    out << "    if (!stats) {\n";
+    out << "        stats = new DWG_FunctionStats{};\n";
+    out << "        thread->functions[index].store(stats, std::memory_order_release);\n";
+    out << "    }\n";
+    out << "    return *stats;\n";
+    out << "}\n";
+    out << "static inline void DWG_Increase(std::atomic<std::uint64_t> &counter, const std::uint64_t value) { counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); }\n";
+    out << "class DWG_CallScope {\n";
+    out << "public:\n";
+    out << "    explicit DWG_CallScope(const std::uint32_t index) : m_index(index), m_start(std::chrono::steady_clock::now()) {}\n";
+    out << "    ~DWG_CallScope() {\n";
+    out << "        const auto nanoseconds = std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());\n";
+    out << "        std::uint32_t bucket = 0;\n";
+    out << "        for (std::uint64_t value = nanoseconds; (value != 0) && (bucket != DWG_StatsBucketCount - 1); value >>= 1) { ++bucket; }\n";
+    out << "        DWG_FunctionStats &stats = ::DWG_GetFunctionStats(m_index);\n";
+    out << "        ::DWG_Increase(stats.calls, 1);\n";
+    out << "        ::DWG_Increase(stats.nanoseconds, nanoseconds);\n";
+    out << "        ::DWG_Increase(stats.buckets[bucket], 1);\n";
+    out << "    }\n";
+    out << "    DWG_CallScope(const DWG_CallScope &) = delete;\n";
+    out << "    DWG_CallScope &operator=(const DWG_CallScope &) = delete;\n";
+    out << "private:\n";
+    out << "    std::uint32_t m_index = 0;\n";
+    out << "    std::chrono::steady_clock::time_point m_start = {};\n";
+    out << "};\n";
+    // Text: one line per called function, "<name> <calls> <total nanoseconds> <bucket 0> ... <bucket N>".
+    out << "extern \"C\" int DWG_DumpStats(std::FILE *file, const int json) {\n";
+    out << "    if (!file) { return -1; }\n";
+    out << "    if (json) { std::fputs(\"{\\\"buckets\\\":\", file); std::fprintf(file, \"%u\", unsigned(DWG_StatsBucketCount)); std::fputs(\",\\\"functions\\\":[\", file); }\n";
+    out << "    else { std::fputs(\"# function calls total_ns log2_ns_buckets...\\n\", file); }\n";
+    out << "    bool first = true;\n";
+    out << "    for (std::uint32_t index = 0; index != DWG_StatsFunctionCount; ++index) {\n";
+    out << "        std::uint64_t calls = 0, nanoseconds = 0, buckets[DWG_StatsBucketCount] = {};\n";
+    out << "        for (const DWG_ThreadStats *thread = DWG_AllThreadStats.load(std::memory_order_acquire); thread; thread = thread->next) {\n";
+    out << "            if (const DWG_FunctionStats *stats = thread->functions[index].load(std::memory_order_acquire)) {\n";
+    out << "                calls += stats->calls.load(std::memory_order_relaxed);\n";
+    out << "                nanoseconds += stats->nanoseconds.load(std::memory_order_relaxed);\n";
+    out << "                for (std::uint32_t bucket = 0; bucket != DWG_StatsBucketCount; ++bucket) { buckets[bucket] += stats->buckets[bucket].load(std::memory_order_relaxed); }\n";
+    out << "            }\n";
+    out << "        }\n";
+    out << "        if (calls == 0) { continue; }\n";
+    out << "        if (json) { std::fprintf(file, \"%s{\\\"name\\\":\\\"%s\\\",\\\"calls\\\":%llu,\\\"total_ns\\\":%llu,\\\"histogram\\\":[\", (first ? \"\" : \",\"), DWG_StatsNames[index], (unsigned long long)calls, (unsigned long long)nanoseconds); }\n";
+    out << "        else { std::fprintf(file, \"%s %llu %llu\", DWG_StatsNames[index], (unsigned long long)calls, (unsigned long long)nanoseconds); }\n";
+    out << "        for (std::uint32_t bucket = 0; bucket != DWG_StatsBucketCount; ++bucket) { std::fprintf(file, \"%s%llu\", (json ? (bucket ? \",\" : \"\") : \" \"), (unsigned long long)buckets[bucket]); }\n";
+    out << "        std::fputs((json ? \"]}\" : \"\\n\"), file);\n";
+    out << "        first = false;\n";
+    out << "    }\n";
+    out << "    if (json) { std::fputs(\"]}\\n\", file); }\n";
+    out << "    return std::fflush(file);\n";
+    out << "}\n";
+    // A call which is running concurrently on another thread may survive the reset.
+    out << "extern \"C\" void DWG_ResetStats() {\n";
+    out << "    for (DWG_ThreadStats *thread = DWG_AllThreadStats.load(std::memory_order_acquire); thread; thread = thread->next) {\n";
+    out << "        for (std::uint32_t index = 0; index != DWG_StatsFunctionCount; ++index) {\n";
+    out << "            if (DWG_FunctionStats *stats = thread->functions[index].load(std::memory_order_acquire)) {\n";
+    out << "                stats->calls.store(0, std::memory_order_relaxed);\n";
+    out << "                stats->nanoseconds.store(0, std::memory_order_relaxed);\n";
+    out << "                for (auto &&bucket : stats->buckets) { bucket.store(0, std::memory_order_relaxed); }\n";
+    out << "            }\n";
+    out << "        }\n";
+    out << "    }\n";
+    out << "}\n";
+}
+
+static inline void writeWrapper(OutputBuffer &out, const GeneratorOptions &options, const BindingMode binding, const Function &function, const std::size_t index, const CallProfile *profile)
+{
+    out << "extern \"C\" ";
+    if (profile) {
+        switch (profile->temperature(function.name)) {
+        case Temperature::Hot:
+            out << "DWG_HOT_WRAPPER ";
+            break;
+        case Temperature::Cold:
+            out << "DWG_COLD_WRAPPER ";
+            break;
+        case Temperature::Warm:
+            break;
+        }
+    }
+    writeFunctionSignature(out, function, {}, function.name);
+    out << " {\n";
+    if (options.instrument) {
+        out << "    const DWG_CallScope scope(" << index << ");\n";
+    }
+    // The lazy wrappers wait in DWG_TryGetLibrary(), the table ones read the slots directly.
+    if (options.preload && usesSymbolTable(binding)) {
+        out << "    ::DWG_WaitForLibrary();\n";
+    }
+    if (usesFallbackStubs(options)) {
+        if (options.pageTraceSeconds > 0) {
+            out << "    ::DWG_TraceCall(" << index << ", DWG_SymbolTable[DWG_Symbol_" << function.name << "]);\n";
+        }
+        // The slot always points to something callable, the real function or a stub.
+        out << "    ";
+        if (!isVoidType(function.resultType)) {
+            out << "return ";
+        }
+        out << "reinterpret_cast<decltype(&::" << function.name << ")>(DWG_SymbolTable[DWG_Symbol_" << function.name << "])";
+        writeCallArguments(out, function);
+        out << ";\n";
+        out << "}\n";
+        return;
+    }
+    if (usesSymbolTable(binding)) {
+        out << "    const auto function = reinterpret_cast<decltype(&::" << function.name << ")>(DWG_SymbolTable[DWG_Symbol_" << function.name << "]);\n";
+    } else {
+        out << "    static const auto function = reinterpret_cast<decltype(&::" << function.name << ")>(::DWG_TryGetSymbol(\"" << function.name << "\"));\n";
+    }
+    if (options.pageTraceSeconds > 0) {
+        out << "    ::DWG_TraceCall(" << index << ", reinterpret_cast<DWG_FunctionPointer>(function));\n";
+    }
+    writeGuardedCall(out, function, profile != nullptr);
+    out << "}\n";
+}
+
+// Every wrapper is an indirect function, its resolver is called by the dynamic linker when it processes the
+// relocations, and the returned address is written to the GOT/PLT slot, so after that the calls go straight to
+// the real function, there's no wrapper frame, no guard and no null check at all.
+// glibc doesn't support dlopen() in a resolver, so they only look into the library if it's already loaded
+// (a dependency of the program, or loaded by it before the wrapper). Otherwise, or if the symbol is
+// missing, the function is bound to a lazy wrapper, which loads the library on its first call, or to a stub
+// which returns the default value of the result type if the function is variadic.
+static inline void writeIFuncs(OutputBuffer &out, const GeneratorOptions &options, const Headers &headers)
+{
+    out << "#include <link.h>\n";
+    out << "// The resolvers run while the dynamic linker processes the relocations, where glibc doesn't support loading a\n";
+    out << "// library (dlopen() even asserts if RTLD_NOLOAD doesn't find it). They only open the library if it's among the\n";
+    out << "// loaded ones, the wrappers below load it otherwise.\n";
+    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_TryGetLoadedSymbol(const std::string_view name) {\n";
+    out << "    const char *path = nullptr;\n";
+    out << "    ::dl_iterate_phdr([](struct dl_phdr_info * const info, std::size_t, void * const data) -> int {\n";
+    out << "        constexpr std::string_view fileName = \"lib" << options.dllFileName << ".so\";\n";
+    out << "        const std::string_view path = info->dlpi_name ? info->dlpi_name : \"\";\n";
+    out << "        const std::string_view baseName = path.substr(path.rfind('/') + 1);\n";
+    // The versioned file names ("libfoo.so.1") count, too.
+    out << "        if ((baseName.substr(0, fileName.size()) != fileName) || ((baseName.size() != fileName.size()) && (baseName[fileName.size()] != '.'))) { return 0; }\n";
+    out << "        *static_cast<const char **>(data) = info->dlpi_name;\n";
+    out << "        return 1;\n";
+    out << "    }, &path);\n";
+    out << "    if (!path) { return nullptr; }\n";
+    out << "    if (const auto library = ::dlopen(path, RTLD_LAZY | RTLD_NOLOAD)) { return ::DWG_GetProcAddress(library, name); } else { return nullptr; }\n";
+    out << "}\n";
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            // The variable arguments can't be forwarded, so there's no lazy wrapper for them.
+            if (function.variadic) {
+                out << "[[gnu::cold]] static ";
+                writeFunctionSignature(out, function, "DWG_Fallback_", function.name, false);
+                if (isVoidType(function.resultType)) {
+                    out << " {}\n";
+                } else {
+                    out << " { return {}; }\n";
+                }
+            } else {
+                out << "[[gnu::cold]] static ";
+                writeFunctionSignature(out, function, "DWG_Fallback_", function.name);
+                out << " {\n";
+                out << "    static const auto function = reinterpret_cast<decltype(&::" << function.name << ")>(::DWG_TryGetSymbol(\"" << function.name << "\"));\n";
+                writeGuardedCall(out, function);
+                out << "}\n";
+            }
+            out << "extern \"C\" { static decltype(&::" << function.name << ") DWG_Resolve_" << function.name << "() { if (const auto symbol = ::DWG_TryGetLoadedSymbol(\"" << function.name << "\")) { return reinterpret_cast<decltype(&::" << function.name << ")>(symbol); } else { return &::DWG_Fallback_" << function.name << "; } } }\n";
+            out << "extern \"C\" ";
+            writeFunctionSignature(out, function, {}, function.name);
+            out << " __attribute__((ifunc(\"DWG_Resolve_" << function.name << "\")));\n";
+        }
+    }
+}
+
+// Honors SOURCE_DATE_EPOCH (https://reproducible-builds.org/specs/source-date-epoch/), so that the
+// generated source only depends on its inputs when the build asks for it.
+[[nodiscard]] static inline std::string generationTimestamp(const std::string_view sourceDateEpoch)
+{
+    // std::gmtime() and std::localtime() share one static buffer, and the server generates concurrently.
+    static std::mutex mutex = {};
+    const std::scoped_lock locker(mutex);
+    char buffer[64] = {};
+    std::uint64_t epoch = 0;
+    if (toUnsigned(sourceDateEpoch, epoch)) {
+        const auto time = std::time_t(epoch);
+        std::strftime(buffer, sizeof(buffer), "%F %T UTC", std::gmtime(&time));
+    } else {
+        const std::time_t now = std::time(nullptr);
+        std::strftime(buffer, sizeof(buffer), "%F %T %z", std::localtime(&now));
+    }
+    return buffer;
+}
+
+// Compares everything but the first line, which only holds the generation time.
+[[nodiscard]] static inline bool isGeneratedFileUpToDate(const std::filesystem::path &path, const std::string_view content)
+{
+    const MappedFile file(path);
+    if (!file.isValid()) {
+        return false;
+    }
+    const std::string_view existing(file.data(), file.size());
+    const std::size_t existingBodyStart = existing.find('\n');
+    const std::size_t bodyStart = content.find('\n');
+    if ((existingBodyStart == std::string_view::npos) || (bodyStart == std::string_view::npos)) {
+        return existing == content;
+    }
+    return existing.substr(existingBodyStart) == content.substr(bodyStart);
+}
+
+// What the headers and the export table of the library disagree on.
+struct ExportReport
+{
+    std::string libraryFileName = {};
+    std::stringlist missingFunctions = {}; // Declared but not exported, these are not wrapped.
+    std::stringlist undeclaredFunctions = {}; // Exported but not declared.
+};
+
+static inline void writeExportReport(OutputBuffer &out, const ExportReport &report)
+{
+    const auto writeNames = [&out](const std::stringlist &names) {
+        for (auto &&name : std::as_const(names)) {
+            out << "//   " << name << '\n';
+        }
+    };
+    out << "// DECLARED BUT NOT EXPORTED BY " << report.libraryFileName << ": " << report.missingFunctions.size() << '\n';
+    writeNames(report.missingFunctions);
+    out << "// EXPORTED BY " << report.libraryFileName << " BUT NOT DECLARED: " << report.undeclaredFunctions.size() << '\n';
+    writeNames(report.undeclaredFunctions);
+}
+
+[[nodiscard]] static inline bool generateWrapper(const std::string_view filePath, const GeneratorOptions &options, const Headers &headers, const ExportReport *exportReport = nullptr, const CallProfile *profile = nullptr)
+{
+    if (filePath.empty() || options.dllFileName.empty() || headers.empty()) {
+        std::cerr << "generateWrapper: invalid parameter" << std::endl;
+        return false;
+    }
+    std::size_t functionCount = 0;
+    for (auto &&header : std::as_const(headers)) {
+        functionCount += header.functions.size();
+    }
+    const auto startTime = std::chrono::steady_clock::now();
+    // A few hundred bytes per wrapper is enough for most of the signatures, the buffer grows if it's not.
+    OutputBuffer out(16 * 1024 + functionCount * 512);
+    out << "// GENERATED BY DLL WRAPPER GENERATOR ON " << generationTimestamp(options.sourceDateEpoch) << '\n';
+    out << "#if !(";
+    writeDirectLinkCondition(out, options);
+    out << ")\n";
+    out << "#ifdef WIN32\n";
+    out << "#  include <windows.h>\n";
+    out << "#  define DWG_API __stdcall\n";
+    out << "#  define DWG_CDECL __cdecl\n";
+    out << "#else\n";
+    out << "#  include <dlfcn.h>\n";
+    out << "#  define DWG_API\n";
+    out << "#  define DWG_CDECL\n";
+    out << "#endif\n";
+    out << "#include <string>\n";
+    if (usesSymbolTable(options.binding)) {
+        out << "#include <cstdint>\n";
+    }
+    if (profile) {
+        out << "#if (__cplusplus >= 202002L) || (defined(_MSVC_LANG) && (_MSVC_LANG >= 202002L))\n";
+        out << "#  define DWG_UNLIKELY [[unlikely]]\n";
+        out << "#else\n";
+        out << "#  define DWG_UNLIKELY\n";
+        out << "#endif\n";
+        // The compiler puts the hot functions into .text.hot and the cold ones into .text.unlikely. Not to be
+        // confused with DWG_COLD of the fallback stubs, which also keeps them from being inlined.
+        out << "#if defined(__GNUC__) || defined(__clang__)\n";
+        out << "#  define DWG_HOT_WRAPPER [[gnu::hot]]\n";
+        out << "#  define DWG_COLD_WRAPPER [[gnu::cold]]\n";
+        out << "#else\n";
+        out << "#  define DWG_HOT_WRAPPER\n";
+        out << "#  define DWG_COLD_WRAPPER\n";
+        out << "#endif\n";
+    }
+    if (options.binding == BindingMode::Thunk) {
+        writeThunkPreamble(out, options);
+    } else if (options.binding == BindingMode::IFunc) {
+        // The resolvers of a shared library run before its own PLT is relocated, they can't call any function there.
+        out << "#if defined(__linux__) && defined(__ELF__) && (defined(__GNUC__) || defined(__clang__)) && (!defined(__PIC__) || defined(__PIE__))\n";
+        out << "#  define DWG_HAS_IFUNC\n";
+        out << "#endif\n";
+    }
+    out << "using DWG_LibraryHandle = void *;\n";
+    out << "using DWG_FunctionPointer = void(DWG_API *)();\n";
+    out << "#ifdef WIN32\n";
+    out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_LoadLibrary(const std::string_view path) { return ::LoadLibrary";
+    if (options.sysDirOnly) {
+        out << "ExA(path.data(), nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32";
+    } else {
+        out << "A(path.data()";
+    }
+    out << "); }\n";
+    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_GetProcAddress(const DWG_LibraryHandle library, const std::string_view name) { return reinterpret_cast<DWG_FunctionPointer>(::GetProcAddress(static_cast<HMODULE>(library), name.data())); }\n";
+    out << "static inline void DWG_API DWG_FreeLibrary(const DWG_LibraryHandle library) { ::FreeLibrary(static_cast<HMODULE>(library)); }\n";
+    out << "#else\n";
+    out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_LoadLibrary(const std::string_view path) { return ::dlopen(path.data(), RTLD_LAZY); }\n";
+    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_GetProcAddress(const DWG_LibraryHandle library, const std::string_view name) { return reinterpret_cast<DWG_FunctionPointer>(::dlsym(library, name.data())); }\n";
+    out << "static inline void DWG_API DWG_FreeLibrary(const DWG_LibraryHandle library) { ::dlclose(library); }\n";
+    out << "#endif\n";
+    if (options.preload) {
+        writeLibraryLoader(out);
+    } else {
+        out << "[[nodiscard]] static inline DWG_LibraryHandle DWG_API DWG_TryGetLibrary() {\n";
+        out << "    static const auto library = ::DWG_LoadLibrary(\n";
+        writeLibraryFileName(out, options);
+        out << "        );\n";
+        out << "    return library;\n";
+        out << "}\n";
+    }
+    out << "[[nodiscard]] static inline DWG_FunctionPointer DWG_API DWG_TryGetSymbol(const std::string_view name) { if (const auto library = ::DWG_TryGetLibrary()) { return ::DWG_GetProcAddress(library, name); } else { return nullptr; } }\n";
+    if (options.offsetCache || (options.pageTraceSeconds > 0)) {
+        writeLibraryImage(out);
+    }
+    std::size_t totalFunctionCount = 0;
+    std::size_t variadicFunctionCount = 0;
+    for (auto &&header : std::as_const(headers)) {
+        out << "#include <" << header.filename << ">\n";
+        totalFunctionCount += header.functions.size();
+        variadicFunctionCount += std::count_if(header.functions.cbegin(), header.functions.cend(), [](const Function &function) -> bool { return function.variadic; });
+    }
+    if (options.instrument) {
+        writeStatsRuntime(out, headers);
+    }
+    if (usesSymbolTable(options.binding)) {
+        std::vector<std::size_t> stubIndexes = {};
+        if (usesFallbackStubs(options)) {
+            stubIndexes = writeFallbackStubs(out, headers, false);
+        } else if (options.binding == BindingMode::Thunk) {
+            out << "#ifdef DWG_HAS_THUNKS\n";
+            stubIndexes = writeFallbackStubs(out, headers, true);
+            out << "#endif\n";
+        }
+        writeSymbolTable(out, options, headers, stubIndexes);
+    }
+    if (options.pageTraceSeconds > 0) {
+        writePageTrace(out, options, totalFunctionCount);
+    }
+    if (options.preload) {
+        writePreloader(out, options);
+    }
+    if (options.binding == BindingMode::Thunk) {
+        out << "#ifdef DWG_HAS_THUNKS\n";
+        writeThunks(out, headers);
+        out << "#else\n";
+    } else if (options.binding == BindingMode::IFunc) {
+        out << "#ifdef DWG_HAS_IFUNC\n";
+        writeIFuncs(out, options, headers);
+        out << "#else\n";
+    }
+    // The fallback of the ifunc mode is the lazy mode, the dynamic linker is not going to help us there.
+    const BindingMode wrapperBinding = (options.binding == BindingMode::IFunc) ? BindingMode::Lazy : options.binding;
+    // We can't forward the variable arguments from C code, only the thunks and the ifuncs can wrap such functions.
+    std::size_t functionIndex = 0;
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            if (!function.variadic) {
+                writeWrapper(out, options, wrapperBinding, function, functionIndex, profile);
+            }
+            ++functionIndex;
+        }
+    }
+    if (canWrapVariadicFunctions(options.binding)) {
+        out << "#endif\n";
+    } else {
+        totalFunctionCount -= variadicFunctionCount;
+        if (variadicFunctionCount > 0) {
+            std::cout << "Skipped " << variadicFunctionCount << " variadic function(s), only the thunk and ifunc binding modes can wrap them." << std::endl;
+        }
+    }
+    // The calls bind to the library itself, only our own API is left, so that its callers don't have to change.
+    if (options.preload || options.instrument || usesFallbackStubs(options)) {
+        out << "#else\n";
+        out << "#include <cstdint>\n";
+        out << "#include <cstdio>\n";
+    }
+    if (options.preload) {
+        out << "extern \"C\" void DWG_Preload() {}\n";
+    }
+    if (options.instrument) {
+        out << "extern \"C\" int DWG_DumpStats(std::FILE *file, const int) { return file ? 0 : -1; }\n";
+        out << "extern \"C\" void DWG_ResetStats() {}\n";
+    }
+    if (usesFallbackStubs(options)) {
+        out << "extern \"C\" std::uint64_t DWG_GetMissingSymbolHitCount() { return 0; }\n";
+    }
+    out << "#endif\n";
+    out << "// WRAPPED FUNCTION COUNT: " << totalFunctionCount << '\n';
+    if (exportReport) {
+        writeExportReport(out, *exportReport);
+    }
+    // Leave the file (and its modification time) alone if nothing changed, so that the build doesn't recompile its dependents.
+    if (options.writeIfChanged && isGeneratedFileUpToDate(std::filesystem::path(filePath), out.view())) {
+        std::cout << "The wrapper source is up to date." << std::endl;
+        return true;
+    }
+    if (!writeFileAtomically(std::filesystem::path(filePath), out.view())) {
+        std::cerr << "generateWrapper: failed to write file:" << filePath << std::endl;
+        return false;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const double megabytes = double(out.view().size()) / (1024.0 * 1024.0);
+    std::cout << "The wrapper source is successfully generated (" << std::fixed << std::setprecision(2) << megabytes << " MiB, "
+              << (seconds > 0.0 ? (megabytes / seconds) : 0.0) << " MiB/s)." << std::defaultfloat << std::endl;
+    return true;
+}
+
+// The inline accessors read the slot and call the real function right at the call site, without the wrapper in
+// between, the compiler of the consumer can inline them without LTO. They live in a namespace named after the
+// library, next to the wrappers, which remain for everything which needs a symbol. Where the library is linked
+// directly, they're just the library functions themselves.
+[[nodiscard]] static inline bool generateInlineHeader(const std::string_view filePath, const GeneratorOptions &options, const Headers &headers)
+{
+    if (filePath.empty() || options.dllFileName.empty() || headers.empty() || (options.binding != BindingMode::Table)) {
+        std::cerr << "generateInlineHeader: invalid parameter" << std::endl;
+        return false;
+    }
+    const std::string namespaceName = "DWG_" + toIdentifier(options.dllFileName);
+    const std::string tableName = exportedSymbolTableName(options);
+    OutputBuffer out(4 * 1024);
+    out << "// GENERATED BY DLL WRAPPER GENERATOR ON " << generationTimestamp(options.sourceDateEpoch) << '\n';
+    out << "#pragma once\n";
+    for (auto &&header : std::as_const(headers)) {
+        out << "#include <" << header.filename << ">\n";
+    }
+    out << "#if ";
+    writeDirectLinkCondition(out, options);
+    out << "\n";
+    // The same names either way, so the variadic functions the accessors can't forward are left out here, too.
+    out << "namespace " << namespaceName << " {\n";
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            if (!function.variadic) {
+                out << "using ::" << function.name << ";\n";
+            }
+        }
+    }
+    out << "}\n";
+    out << "#else\n";
+    out << "#ifdef WIN32\n";
+    out << "#  define DWG_API __stdcall\n";
+    out << "#  define DWG_CDECL __cdecl\n";
+    out << "#else\n";
+    out << "#  define DWG_API\n";
+    out << "#  define DWG_CDECL\n";
+    out << "#endif\n";
+    out << "using DWG_FunctionPointer = void(DWG_API *)();\n";
+    std::size_t functionCount = 0;
+    for (auto &&header : std::as_const(headers)) {
+        functionCount += header.functions.size();
+    }
+    out << "extern \"C\" DWG_FunctionPointer " << tableName << "[" << functionCount << "];\n";
+    out << "namespace " << namespaceName << " {\n";
+    // The same slots as the wrappers, so the table order decides the index, the variadic functions can't be forwarded.
+    std::size_t functionIndex = 0;
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&function : std::as_const(header.functions)) {
+            if (!function.variadic) {
+                out << "inline ";
+                writeFunctionSignature(out, function, {}, function.name);
+                out << " {\n";
+                out << "    const auto function = reinterpret_cast<decltype(&::" << function.name << ")>(::" << tableName << "[" << functionIndex << "]);\n";
+                if (usesFallbackStubs(options)) {
+                    out << "    ";
+                    if (!isVoidType(function.resultType)) {
+                        out << "return ";
+                    }
+                    out << "function";
+                    writeCallArguments(out, function);
+                    out << ";\n";
+                } else {
+                    writeGuardedCall(out, function);
+                }
+                out << "}\n";
+            }
+            ++functionIndex;
+        }
+    }
+    out << "}\n";
+    out << "#endif\n";
+    if (options.writeIfChanged && isGeneratedFileUpToDate(std::filesystem::path(filePath), out.view())) {
+        std::cout << "The inline header is up to date." << std::endl;
+        return true;
+    }
+    if (!writeFileAtomically(std::filesystem::path(filePath), out.view())) {
+        std::cerr << "generateInlineHeader: failed to write file:" << filePath << std::endl;
+        return false;
+    }
+    std::cout << "The inline header is successfully generated." << std::endl;
+    return true;
+}
+
+// Spaces, '#' and '$' are the only characters Make and Ninja treat specially in a file name.
+[[nodiscard]] static inline std::string escapeDepfilePath(const std::string_view path)
+{
+    std::string result = {};
+    result.reserve(path.size());
+    for (auto &&c : path) {
+        if ((c == ' ') || (c == '#')) {
+            result += '\\';
+        } else if (c == '$') {
+            result += '$';
+        }
+        result += c;
+    }
+    return result;
+}
+
+// Writes a Make/Ninja compatible depfile, which makes the output file depend on every file libclang read.
+[[nodiscard]] static inline bool writeDepfile(const std::string_view depfilePath, const std::string_view outputPath, const std::stringlist &inputPaths, const Headers &headers)
+{
+    if (depfilePath.empty() || outputPath.empty()) {
+        std::cerr << "writeDepfile: invalid parameter" << std::endl;
+        return false;
+    }
+    // libclang reports the files of the umbrella translation unit with absolute paths, make all of them
+    // absolute, so that the same file is never listed twice.
+    std::stringlist dependencies = {};
+    const auto addDependency = [&dependencies](const std::string_view path) {
+        dependencies.push_back(toAbsolutePath(path));
+    };
+    for (auto &&inputPath : std::as_const(inputPaths)) {
+        addDependency(inputPath);
+    }
+    for (auto &&header : std::as_const(headers)) {
+        for (auto &&dependency : std::as_const(header.dependencies)) {
+            addDependency(dependency);
+        }
+    }
+    std::sort(dependencies.begin(), dependencies.end());
+    dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+    OutputBuffer out(dependencies.size() * 128);
+    out << escapeDepfilePath(fromNativeSeparators(outputPath)) << ':';
+    for (auto &&dependency : std::as_const(dependencies)) {
+        out << " \\\n  " << escapeDepfilePath(fromNativeSeparators(dependency));
+    }
+    out << '\n';
+    if (!writeFileAtomically(std::filesystem::path(depfilePath), out.view())) {
+        std::cerr << "writeDepfile: failed to write file:" << depfilePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A bounds checked reader of the ELF files of both classes and both byte orders, it only knows what we need
+// to walk the section headers and the symbol tables. Everything out of bounds reads as zero.
+class ElfFile
+{
+public:
+    struct Section
+    {
+        std::uint32_t type = 0;
+        std::uint64_t address = 0;
+        std::uint64_t offset = 0;
+        std::uint64_t size = 0;
+        std::uint32_t link = 0;
+        std::uint64_t entrySize = 0;
+    };
+
+    struct Symbol
+    {
+        std::string_view name = {};
+        std::uint8_t binding = 0;
+        std::uint8_t type = 0;
+        std::uint16_t sectionIndex = 0;
+        std::uint64_t value = 0;
+    };
+
+    static constexpr std::uint32_t kSymbolTable = 2; // SHT_SYMTAB
+    static constexpr std::uint32_t kDynamicSymbolTable = 11; // SHT_DYNSYM
+    static constexpr std::uint32_t kGnuHashTable = 0x6FFFFFF6; // SHT_GNU_HASH
+    static constexpr std::uint32_t kSymbolVersions = 0x6FFFFFFF; // SHT_GNU_versym
+    static constexpr std::uint8_t kGlobalBinding = 1; // STB_GLOBAL
+    static constexpr std::uint8_t kWeakBinding = 2; // STB_WEAK
+    static constexpr std::uint8_t kUniqueBinding = 10; // STB_GNU_UNIQUE
+    static constexpr std::uint8_t kNoType = 0; // STT_NOTYPE
+    static constexpr std::uint8_t kFunctionType = 2; // STT_FUNC
+    static constexpr std::uint8_t kIndirectFunctionType = 10; // STT_GNU_IFUNC
+    static constexpr std::uint16_t kUndefinedSection = 0; // SHN_UNDEF
+
+    [[nodiscard]] static inline bool isElf(const std::string_view data) {
+        return data.starts_with("\x7F" "ELF");
+    }
+
+    explicit ElfFile(const std::string_view data) : m_data(data) {
+        if ((data.size() < 52) || !isElf(data)) {
+            return;
+        }
+        const auto elfClass = std::uint8_t(data[4]); // 1: 32 bit, 2: 64 bit.
+        const auto byteOrder = std::uint8_t(data[5]); // 1: little endian, 2: big endian.
+        if (((elfClass != 1) && (elfClass != 2)) || ((byteOrder != 1) && (byteOrder != 2))) {
+            return;
+        }
+        m_is64Bit = (elfClass == 2);
+        m_swapBytes = ((byteOrder == 2) != (std::endian::native == std::endian::big));
+        if (m_is64Bit && (data.size() < 64)) {
+            return;
+        }
+        m_type = read<std::uint16_t>(16);
+        m_machine = read<std::uint16_t>(18);
+        const std::uint64_t sectionHeaderOffset = m_is64Bit ? read<std::uint64_t>(0x28) : read<std::uint32_t>(0x20);
+        const std::uint64_t sectionHeaderSize = read<std::uint16_t>(m_is64Bit ? 0x3A : 0x2E);
+        std::uint64_t sectionCount = read<std::uint16_t>(m_is64Bit ? 0x3C : 0x30);
+        if (sectionHeaderOffset == 0) {
+            m_valid = true;
+            return;
+        }
+        if (sectionHeaderSize < (m_is64Bit ? 0x40 : 0x28)) {
+            return;
+        }
+        // With 0xff00 sections or more the real count is kept in the first section header.
+        if (sectionCount == 0) {
+            sectionCount = readSection(sectionHeaderOffset).size;
+        }
+        if ((sectionHeaderOffset > data.size()) || (sectionCount > ((data.size() - sectionHeaderOffset) / sectionHeaderSize))) {
+            return;
+        }
+        m_sections.reserve(std::size_t(sectionCount));
+        for (std::uint64_t index = 0; index != sectionCount; ++index) {
+            m_sections.push_back(readSection(sectionHeaderOffset + index * sectionHeaderSize));
+        }
+        m_valid = true;
+    }
+
+    [[nodiscard]] inline bool isValid() const {
+        return m_valid;
+    }
+
+    [[nodiscard]] inline bool is64Bit() const {
+        return m_is64Bit;
+    }
+
+    [[nodiscard]] inline std::uint16_t type() const {
+        return m_type;
+    }
+
+    [[nodiscard]] inline std::uint16_t machine() const {
+        return m_machine;
+    }
+
+    [[nodiscard]] inline const std::vector<Section> &sections() const {
+        return m_sections;
+    }
+
+    [[nodiscard]] inline const Section *findSection(const std::uint32_t type) const {
+        const auto it = std::find_if(m_sections.cbegin(), m_sections.cend(), [type](const Section &section) -> bool { return section.type == type; });
+        return (it == m_sections.cend()) ? nullptr : &*it;
+    }
+
+    // Empty if the section is out of the bounds of the file.
+    [[nodiscard]] inline std::string_view sectionData(const Section &section) const {
+        if ((section.offset > m_data.size()) || (section.size > (m_data.size() - section.offset))) {
+            return {};
+        }
+        return m_data.substr(std::size_t(section.offset), std::size_t(section.size));
+    }
+
+    // Zero if the table is broken.
+    [[nodiscard]] inline std::uint64_t symbolCount(const Section &table) const {
+        if ((table.link >= m_sections.size()) || (table.entrySize < (m_is64Bit ? 24 : 16))) {
+            return 0;
+        }
+        return sectionData(table).size() / table.entrySize;
+    }
+
+    // The index must be less than symbolCount().
+    [[nodiscard]] inline Symbol symbolAt(const Section &table, const std::uint64_t index) const {
+        const std::uint64_t position = table.offset + index * table.entrySize;
+        Symbol symbol = {};
+        const std::uint32_t nameOffset = read<std::uint32_t>(position);
+        std::uint8_t info = 0;
+        if (m_is64Bit) {
+            info = read<std::uint8_t>(position + 4);
+            symbol.sectionIndex = read<std::uint16_t>(position + 6);
+            symbol.value = read<std::uint64_t>(position + 8);
+        } else {
+            symbol.value = read<std::uint32_t>(position + 4);
+            info = read<std::uint8_t>(position + 12);
+            symbol.sectionIndex = read<std::uint16_t>(position + 14);
+        }
+        symbol.binding = std::uint8_t(info >> 4);
+        symbol.type = std::uint8_t(info & 0xF);
+        const std::string_view strings = sectionData(m_sections[table.link]);
+        if (nameOffset < strings.size()) {
+            symbol.name = strings.substr(nameOffset);
+            symbol.name = symbol.name.substr(0, symbol.name.find('\0'));
+        }
+        return symbol;
+    }
+
+    template<typename Callback>
+    inline void forEachSymbol(const Section &table, const Callback &callback) const {
+        const std::uint64_t count = symbolCount(table);
+        // The first symbol is always the null symbol.
+        for (std::uint64_t index = 1; index < count; ++index) {
+            callback(symbolAt(table, index));
+        }
+    }
+
+    template<typename T>
+    [[nodiscard]] inline T read(const std::uint64_t offset) const {
+        T value = 0;
+        if ((offset > m_data.size()) || (sizeof(T) > (m_data.size() - offset))) {
+            return value;
+        }
+        std::memcpy(&value, m_data.data() + offset, sizeof(T));
+        if (m_swapBytes) {
+            auto bytes = reinterpret_cast<unsigned char *>(&value);
+            std::reverse(bytes, bytes + sizeof(T));
+        }
+        return value;
+    }
+
+private:
+    [[nodiscard]] inline Section readSection(const std::uint64_t offset) const {
+        Section section = {};
+        section.type = read<std::uint32_t>(offset + 4);
+        if (m_is64Bit) {
+            section.address = read<std::uint64_t>(offset + 0x10);
+            section.offset = read<std::uint64_t>(offset + 0x18);
+            section.size = read<std::uint64_t>(offset + 0x20);
+            section.link = read<std::uint32_t>(offset + 0x28);
+            section.entrySize = read<std::uint64_t>(offset + 0x38);
+        } else {
+            section.address = read<std::uint32_t>(offset + 0x0C);
+            section.offset = read<std::uint32_t>(offset + 0x10);
+            section.size = read<std::uint32_t>(offset + 0x14);
+            section.link = read<std::uint32_t>(offset + 0x18);
+            section.entrySize = read<std::uint32_t>(offset + 0x24);
+        }
+        return section;
+    }
+
+    std::string_view m_data = {};
+    bool m_valid = false;
+    bool m_is64Bit = false;
+    bool m_swapBytes = false;
+    std::uint16_t m_type = 0;
+    std::uint16_t m_machine = 0;
+    std::vector<Section> m_sections = {};
+};
+
+// Appends the symbols an ELF object (or a linked binary) references but doesn't define.
+[[nodiscard]] static inline bool collectUndefinedSymbols(const std::string_view data, const std::string_view name, std::stringlist &symbolsOut)
+{
+    const ElfFile elf(data);
+    if (!elf.isValid()) {
+        std::cerr << "Not a valid ELF file:" << name << std::endl;
+        return false;
+    }
+    // The static symbol table of a linked binary may be stripped, its imports are in the dynamic one anyway.
+    const ElfFile::Section *table = elf.findSection(ElfFile::kSymbolTable);
+    if (!table) {
+        table = elf.findSection(ElfFile::kDynamicSymbolTable);
+    }
+    if (!table) {
+        return true;
+    }
+    bool slimLtoObject = false;
+    elf.forEachSymbol(*table, [&symbolsOut, &slimLtoObject](const ElfFile::Symbol &symbol) {
+        if (symbol.name == "__gnu_lto_slim") {
+            slimLtoObject = true;
+        }
+        if ((symbol.sectionIndex != ElfFile::kUndefinedSection) || symbol.name.empty()) {
+            return;
+        }
+        if ((symbol.binding != ElfFile::kGlobalBinding) && (symbol.binding != ElfFile::kWeakBinding)) {
+            return;
+        }
+        // Drop the version of a versioned reference ("foo@VERS_1.0").
+        symbolsOut.emplace_back(symbol.name.substr(0, symbol.name.find('@')));
+    });
+    // The symbols of a slim LTO object are only known to the LTO plugin, its ELF symbol table is empty.
+    if (slimLtoObject) {
+        std::cerr << "Can't read the symbols of a slim LTO object (build it with -ffat-lto-objects):" << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Appends the undefined symbols of an object file, a linked binary or of every member of a static archive
+// (thin archives included, their members are read from the files they refer to).
+[[nodiscard]] static inline bool scanConsumerFile(const std::string &path, std::stringlist &symbolsOut)
+{
+    const MappedFile file(path);
+    if (!file.isValid()) {
+        std::cerr << "Failed to read the consumer file:" << path << std::endl;
+        return false;
+    }
+    const std::string_view data(file.data(), file.size());
+    const bool thin = data.starts_with("!<thin>\n");
+    if (!thin && !data.starts_with("!<arch>\n")) {
+        return collectUndefinedSymbols(data, path, symbolsOut);
+    }
+    // Every member is a 60 bytes header (name[16], date[12], uid[6], gid[6], mode[8], size[10], "`\n")
+    // followed by its data, padded to an even size.
+    std::string_view longNames = {};
+    for (std::size_t offset = 8; (offset + 60) <= data.size();) {
+        const std::string_view header = data.substr(offset, 60);
+        std::uint64_t memberSize = 0;
+        const std::string_view sizeField = header.substr(48, 10);
+        if ((header.substr(58, 2) != "`\n") || (std::from_chars(sizeField.data(), sizeField.data() + sizeField.size(), memberSize).ec != std::errc{})) {
+            std::cerr << "Malformed static archive:" << path << std::endl;
+            return false;
+        }
+        std::string_view name = header.substr(0, 16);
+        // The symbol index and the long name table are stored even in a thin archive, the objects aren't.
+        const bool symbolIndex = name.starts_with("/ ") || name.starts_with("/SYM64/") || name.starts_with("__.SYMDEF");
+        const bool longNameTable = name.starts_with("// ");
+        const std::uint64_t storedSize = (thin && !symbolIndex && !longNameTable) ? 0 : memberSize;
+        const std::size_t dataOffset = offset + 60;
+        if (storedSize > (data.size() - dataOffset)) {
+            std::cerr << "Truncated static archive:" << path << std::endl;
+            return false;
+        }
+        std::string_view member = data.substr(dataOffset, std::size_t(storedSize));
+        offset = dataOffset + std::size_t(storedSize + (storedSize & 1));
+        if (symbolIndex) {
+            continue;
+        }
+        if (longNameTable) {
+            longNames = member;
+            continue;
+        }
+        if (name.starts_with("#1/")) {
+            // BSD stores the long names in front of the data.
+            std::size_t nameLength = 0;
+            std::from_chars(name.data() + 3, name.data() + name.size(), nameLength);
+            nameLength = std::min(nameLength, member.size());
+            name = member.substr(0, nameLength);
+            member.remove_prefix(nameLength);
+            if (name.starts_with("__.SYMDEF")) {
+                continue;
+            }
+        } else if (name.starts_with('/')) {
+            // "/123" is an offset into the long name table, every name there ends with "/\n".
+            std::size_t nameOffset = 0;
+            std::from_chars(name.data() + 1, name.data() + name.size(), nameOffset);
+            name = (nameOffset < longNames.size()) ? longNames.substr(nameOffset) : std::string_view{};
+            name = name.substr(0, name.find("/\n"));
+        } else {
+            name = name.substr(0, name.find('/'));
+        }
+        if (thin) {
+            std::filesystem::path memberPath(name);
+            if (memberPath.is_relative()) {
+                memberPath = std::filesystem::path(path).parent_path() / memberPath;
+            }
+            if (!scanConsumerFile(memberPath.string(), symbolsOut)) {
+                return false;
+            }
+            continue;
+        }
+        const std::string memberName = path + '(' + std::string(name) + ')';
+        if (!ElfFile::isElf(member)) {
+            std::cerr << "Not an ELF object (LTO bitcode can't be read):" << memberName << std::endl;
+            return false;
+        }
+        if (!collectUndefinedSymbols(member, memberName, symbolsOut)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keeps only the functions which the consumer files reference, the rest would be dead weight in the wrapper.
+[[nodiscard]] static inline bool selectUsedFunctions(const std::stringlist &consumerFiles, const Headers &headers, Headers &headersOut)
+{
+    std::stringlist usedSymbols = {};
+    for (auto &&consumerFile : std::as_const(consumerFiles)) {
+        if (!scanConsumerFile(consumerFile, usedSymbols)) {
+            return false;
+        }
+    }
+    std::sort(usedSymbols.begin(), usedSymbols.end());
+    usedSymbols.erase(std::unique(usedSymbols.begin(), usedSymbols.end()), usedSymbols.end());
+    Headers selectedHeaders = {};
+    selectedHeaders.reserve(headers.size());
+    std::size_t totalFunctionCount = 0;
+    std::size_t usedFunctionCount = 0;
+    for (auto &&header : std::as_const(headers)) {
+        Header selectedHeader = {};
+        selectedHeader.filename = header.filename;
+        selectedHeader.dependencies = header.dependencies;
+        for (auto &&function : std::as_const(header.functions)) {
+            if (std::binary_search(usedSymbols.cbegin(), usedSymbols.cend(), function.name)) {
+                selectedHeader.functions.push_back(function);
+            }
+        }
+        totalFunctionCount += header.functions.size();
+        usedFunctionCount += selectedHeader.functions.size();
+        selectedHeaders.push_back(std::move(selectedHeader));
+    }
+    std::cout << "The consumer files use " << usedFunctionCount << " of the " << totalFunctionCount << " parsed function(s)." << std::endl;
+    // There would be nothing to put in the wrapper, and an empty symbol table doesn't even compile.
+    if (usedFunctionCount == 0) {
+        std::cerr << "The consumer files don't use any of the parsed functions." << std::endl;
+        return false;
+    }
+    headersOut = std::move(selectedHeaders);
+    return true;
+}
+
+// Sorts the functions by their call counts, the hottest first, so that their wrappers (and their table slots, their
+// names and their thunks) end up next to each other. The functions are tied to their headers by the includes only,
+// so they all move to the first header, the order of the equally hot ones is kept.
+static inline void orderByProfile(const Headers &headers, const CallProfile &profile, Headers &headersOut)
+{
+    Headers orderedHeaders = {};
+    orderedHeaders.reserve(headers.size());
+    Functions functions = {};
+    for (auto &&header : std::as_const(headers)) {
+        Header orderedHeader = {};
+        orderedHeader.filename = header.filename;
+        orderedHeader.dependencies = header.dependencies;
+        orderedHeaders.push_back(std::move(orderedHeader));
+        functions.insert(functions.end(), header.functions.cbegin(), header.functions.cend());
+    }
+    std::vector<std::uint64_t> calls = {};
+    calls.reserve(functions.size());
+    for (auto &&function : std::as_const(functions)) {
+        calls.push_back(profile.calls(function.name));
+    }
+    std::vector<std::size_t> order(functions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&calls](const std::size_t lhs, const std::size_t rhs) -> bool { return calls[lhs] > calls[rhs]; });
+    std::size_t temperatures[3] = {};
+    Functions &orderedFunctions = orderedHeaders.front().functions;
+    orderedFunctions.reserve(functions.size());
+    for (auto &&index : std::as_const(order)) {
+        ++temperatures[std::size_t(profile.temperature(functions[index].name))];
+        orderedFunctions.push_back(std::move(functions[index]));
+    }
+    std::cout << "The profile marks " << temperatures[std::size_t(Temperature::Hot)] << " function(s) hot and " << temperatures[std::size_t(Temperature::Cold)] << " cold, "
+              << temperatures[std::size_t(Temperature::Warm)] << " are in between." << std::endl;
+    headersOut = std::move(orderedHeaders);
+}
+
+// The functions a shared library exports, read from its dynamic symbol table without loading the library.
+// The lookups go through the GNU hash table of the library (bloom filter, bucket, hash chain), just like the
+// dynamic linker does them, a library which only has the old SysV hash table is looked up by binary search.
+class ExportTable
+{
+public:
+    explicit ExportTable(const std::string &path) : m_file(path), m_elf(std::string_view(m_file.data(), m_file.size())) {
+        if (!m_elf.isValid()) {
+            return;
+        }
+        m_symbols = m_elf.findSection(ElfFile::kDynamicSymbolTable);
+        if (!m_symbols) {
+            return;
+        }
+        m_symbolCount = m_elf.symbolCount(*m_symbols);
+        const std::vector<ElfFile::Section> &sections = m_elf.sections();
+        for (auto &&section : std::as_const(sections)) {
+            const bool forSymbols = (section.link < sections.size()) && (&sections[section.link] == m_symbols);
+            if ((section.type == ElfFile::kGnuHashTable) && forSymbols) {
+                m_hashTable = &section;
+            } else if ((section.type == ElfFile::kSymbolVersions) && (section.size >= (m_symbolCount * 2))) {
+                m_versions = &section;
+            }
+        }
+        if (m_hashTable) {
+            // u32 bucket count, u32 index of the first hashed symbol, u32 bloom filter size (in words),
+            // u32 bloom shift, then the bloom filter, the buckets and the hash chain.
+            const std::uint64_t offset = m_hashTable->offset;
+            m_bucketCount = m_elf.read<std::uint32_t>(offset);
+            m_firstHashedSymbol = m_elf.read<std::uint32_t>(offset + 4);
+            m_bloomSize = m_elf.read<std::uint32_t>(offset + 8);
+            m_bloomShift = m_elf.read<std::uint32_t>(offset + 12);
+            m_bloomOffset = offset + 16;
+            m_bucketOffset = m_bloomOffset + std::uint64_t(m_bloomSize) * (m_elf.is64Bit() ? 8 : 4);
+            m_chainOffset = m_bucketOffset + std::uint64_t(m_bucketCount) * 4;
+            if ((m_bucketCount == 0) || (m_bloomSize == 0) || (m_chainOffset > (offset + m_hashTable->size))) {
+                m_hashTable = nullptr;
+            }
+        }
+        if (!m_hashTable) {
+            forEachExportedFunction([this](const std::string_view name) { m_sortedNames.push_back(name); }, true);
+            std::sort(m_sortedNames.begin(), m_sortedNames.end());
+        }
+    }
+
+    ExportTable(const ExportTable &) = delete;
+    ExportTable &operator=(const ExportTable &) = delete;
+
+    [[nodiscard]] inline bool isValid() const {
+        return m_symbols != nullptr;
+    }
+
+    [[nodiscard]] inline bool hasGnuHashTable() const {
+        return m_hashTable != nullptr;
+    }
+
+    [[nodiscard]] inline bool exports(const std::string_view name) const {
+        if (!m_hashTable) {
+            return std::binary_search(m_sortedNames.cbegin(), m_sortedNames.cend(), name);
+        }
+        const std::uint32_t hash = gnuHash(name);
+        const std::uint32_t wordBits = m_elf.is64Bit() ? 64 : 32;
+        const std::uint64_t wordOffset = m_bloomOffset + std::uint64_t((hash / wordBits) % m_bloomSize) * (wordBits / 8);
+        const std::uint64_t word = m_elf.is64Bit() ? m_elf.read<std::uint64_t>(wordOffset) : m_elf.read<std::uint32_t>(wordOffset);
+        const std::uint64_t mask = (std::uint64_t(1) << (hash % wordBits)) | (std::uint64_t(1) << ((hash >> m_bloomShift) % wordBits));
+        if ((word & mask) != mask) {
+            return false;
+        }
+        std::uint64_t index = m_elf.read<std::uint32_t>(m_bucketOffset + std::uint64_t(hash % m_bucketCount) * 4);
+        if (index < m_firstHashedSymbol) {
+            return false;
+        }
+        // The lowest bit of a chain entry marks the end of the chain.
+        for (; index < m_symbolCount; ++index) {
+            const std::uint32_t chainHash = m_elf.read<std::uint32_t>(m_chainOffset + (index - m_firstHashedSymbol) * 4);
+            // Untyped exports count, just like in the sorted list of the libraries without a GNU hash table.
+            if (((chainHash | 1) == (hash | 1)) && isExportedFunction(index, true)) {
+                if (m_elf.symbolAt(*m_symbols, index).name == name) {
+                    return true;
+                }
+            }
+            if (chainHash & 1) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Anything without a type counts as a function when we look one up (hand written assembly often doesn't
+    // set it), but only the typed functions are enumerated, the untyped exports are mostly linker symbols.
+    template<typename Callback>
+    inline void forEachExportedFunction(const Callback &callback, const bool includeUntyped = false) const {
+        for (std::uint64_t index = 1; index < m_symbolCount; ++index) {
+            if (isExportedFunction(index, includeUntyped)) {
+                callback(m_elf.symbolAt(*m_symbols, index).name);
+            }
+        }
+    }
+
+private:
+    [[nodiscard]] inline bool isExportedFunction(const std::uint64_t index, const bool includeUntyped) const {
+        const ElfFile::Symbol symbol = m_elf.symbolAt(*m_symbols, index);
+        if ((symbol.sectionIndex == ElfFile::kUndefinedSection) || symbol.name.empty()) {
+            return false;
+        }
+        if ((symbol.binding != ElfFile::kGlobalBinding) && (symbol.binding != ElfFile::kWeakBinding) && (symbol.binding != ElfFile::kUniqueBinding)) {
+            return false;
+        }
+        if ((symbol.type != ElfFile::kFunctionType) && (symbol.type != ElfFile::kIndirectFunctionType) && (!includeUntyped || (symbol.type != ElfFile::kNoType))) {
+            return false;
+        }
+        if (m_versions) {
+            // Version 0 is local, a hidden (non-default) version can't be found by its plain name.
+            const std::uint16_t version = m_elf.read<std::uint16_t>(m_versions->offset + index * 2);
+            if (((version & 0x7FFF) == 0) || (version & 0x8000)) {
+                return false;
             }
-            functionCallStr += ')';
-            out << "    if (function) { ";
-            if (function.resultType.empty() || function.resultType == "void") {
-                out << functionCallStr << "; }";
+        }
+        return true;
+    }
+
+    MappedFile m_file;
+    ElfFile m_elf;
+    const ElfFile::Section *m_symbols = nullptr;
+    const ElfFile::Section *m_hashTable = nullptr;
+    const ElfFile::Section *m_versions = nullptr;
+    std::uint64_t m_symbolCount = 0;
+    std::uint32_t m_bucketCount = 0;
+    std::uint32_t m_firstHashedSymbol = 0;
+    std::uint32_t m_bloomSize = 0;
+    std::uint32_t m_bloomShift = 0;
+    std::uint64_t m_bloomOffset = 0;
+    std::uint64_t m_bucketOffset = 0;
+    std::uint64_t m_chainOffset = 0;
+    std::vector<std::string_view> m_sortedNames = {};
+};
+
+// Drops the functions the library doesn't export (their wrappers would never find anything) and records
+// them, together with the exported functions no header declares, in the report.
+[[nodiscard]] static inline bool checkExports(const std::string &libraryFile, const Headers &headers, Headers &headersOut, ExportReport &reportOut)
+{
+    const ExportTable exportTable(libraryFile);
+    if (!exportTable.isValid()) {
+        std::cerr << "Failed to read the dynamic symbol table of the library:" << libraryFile << std::endl;
+        return false;
+    }
+    ExportReport report = {};
+    report.libraryFileName = extractFileName(libraryFile);
+    std::vector<std::string_view> declaredNames = {};
+    Headers exportedHeaders = {};
+    exportedHeaders.reserve(headers.size());
+    for (auto &&header : std::as_const(headers)) {
+        Header exportedHeader = {};
+        exportedHeader.filename = header.filename;
+        exportedHeader.dependencies = header.dependencies;
+        for (auto &&function : std::as_const(header.functions)) {
+            declaredNames.push_back(function.name);
+            if (exportTable.exports(function.name)) {
+                exportedHeader.functions.push_back(function);
             } else {
-                out << "return " << functionCallStr << "; } else { return " << function.resultType << "{}; }";
+                report.missingFunctions.push_back(function.name);
+            }
+        }
+        exportedHeaders.push_back(std::move(exportedHeader));
+    }
+    std::sort(declaredNames.begin(), declaredNames.end());
+    exportTable.forEachExportedFunction([&declaredNames, &report](const std::string_view name) {
+        if (!std::binary_search(declaredNames.cbegin(), declaredNames.cend(), name)) {
+            report.undeclaredFunctions.emplace_back(name);
+        }
+    });
+    std::sort(report.missingFunctions.begin(), report.missingFunctions.end());
+    std::sort(report.undeclaredFunctions.begin(), report.undeclaredFunctions.end());
+    report.undeclaredFunctions.erase(std::unique(report.undeclaredFunctions.begin(), report.undeclaredFunctions.end()), report.undeclaredFunctions.end());
+    std::cout << report.libraryFileName << ": " << report.missingFunctions.size() << " declared function(s) are not exported, "
+              << report.undeclaredFunctions.size() << " exported function(s) are not declared." << std::endl;
+    if (report.missingFunctions.size() == declaredNames.size()) {
+        std::cerr << "The library doesn't export any of the parsed functions:" << libraryFile << std::endl;
+        return false;
+    }
+    headersOut = std::move(exportedHeaders);
+    reportOut = std::move(report);
+    return true;
+}
+
+// Everything one invocation of the generator needs, it's also what a client sends to the server.
+struct Request
+{
+    std::stringlist inputFiles = {};
+    std::stringlist consumerFiles = {}; // Only wrap the functions these objects, archives or binaries reference.
+    std::string libraryFile = {}; // Only wrap the functions this library exports.
+    std::string profileFile = {}; // Lay the wrappers out by the call counts of this profile.
+    std::string outputFile = {};
+    std::string inlineHeaderFile = {};
+    std::string depfile = {};
+    GeneratorOptions generatorOptions = {};
+    ParseOptions parseOptions = {};
+};
+
+// Writes the wrapper source (and the depfile) of the parsed headers.
+[[nodiscard]] static inline bool generateOutputs(const Request &request, const Headers &headers)
+{
+    // The report covers everything the headers declare, so check the exports before dropping the unused functions.
+    Headers exportedHeaders = {};
+    ExportReport exportReport = {};
+    const bool checkExported = !request.libraryFile.empty();
+    if (checkExported && !checkExports(request.libraryFile, headers, exportedHeaders, exportReport)) {
+        return false;
+    }
+    Headers usedHeaders = {};
+    const bool selectUsed = !request.consumerFiles.empty();
+    if (selectUsed && !selectUsedFunctions(request.consumerFiles, checkExported ? exportedHeaders : headers, usedHeaders)) {
+        return false;
+    }
+    const Headers &wrappedHeaders = selectUsed ? usedHeaders : (checkExported ? exportedHeaders : headers);
+    CallProfile profile = {};
+    Headers orderedHeaders = {};
+    const bool useProfile = !request.profileFile.empty();
+    if (useProfile) {
+        if (!profile.load(request.profileFile)) {
+            return false;
+        }
+        orderByProfile(wrappedHeaders, profile, orderedHeaders);
+    }
+    const Headers &layoutHeaders = useProfile ? orderedHeaders : wrappedHeaders;
+    GeneratorOptions generatorOptions = request.generatorOptions;
+    generatorOptions.exportSymbolTable = !request.inlineHeaderFile.empty();
+    if (!generateWrapper(request.outputFile, generatorOptions, layoutHeaders, checkExported ? &exportReport : nullptr, useProfile ? &profile : nullptr)) {
+        return false;
+    }
+    if (generatorOptions.exportSymbolTable && !generateInlineHeader(request.inlineHeaderFile, generatorOptions, layoutHeaders)) {
+        return false;
+    }
+    if (request.depfile.empty()) {
+        return true;
+    }
+    std::stringlist inputFiles = request.inputFiles;
+    inputFiles.insert(inputFiles.end(), request.consumerFiles.cbegin(), request.consumerFiles.cend());
+    if (checkExported) {
+        inputFiles.push_back(request.libraryFile);
+    }
+    if (useProfile) {
+        inputFiles.push_back(request.profileFile);
+    }
+    return writeDepfile(request.depfile, request.outputFile, inputFiles, headers);
+}
+
+[[nodiscard]] static inline bool runRequest(const Request &request)
+{
+    Headers headers = {};
+    if (!parseHeaders(request.inputFiles, request.parseOptions, headers) || headers.empty()) {
+        return false;
+    }
+    if (!request.parseOptions.memoryGuard.check("parse")) {
+        return false;
+    }
+    if (!generateOutputs(request, headers)) {
+        return false;
+    }
+    return request.parseOptions.memoryGuard.check("generate");
+}
+
+// A request is sent as:
+// - u32 magic, u32 format version (the server refuses any other one),
+// - u32 input file count, string input files..., u32 consumer file count, string consumer files...,
+// - string library file, string profile file, string output file, string inline header file, string depfile,
+// - the generator options: string DLL file name, u8 sys dir only, u8 binding mode, u8 fallback stubs, u8 instrument,
+//   u8 direct lookup, u8 offset cache, u8 preload, u32 page trace seconds, u8 write if changed,
+//   string SOURCE_DATE_EPOCH,
+// - the parse options: u64 thread count, string cache directory, u8 umbrella, string compilation database,
+//   string compile commands entry, string prefix header.
+// Every string is a u32 length followed by the characters, every integer is in the byte order of the machine, the
+// client and the server always run on the same one. An empty string means the option wasn't given.
+// The memory guard is not sent, the server is shared by many requests, the limit means nothing to it. Whether the
+// symbol table is exported isn't either, it follows from the inline header file.
+class RequestCodec
+{
+public:
+    static constexpr std::uint32_t kMagic = 0x52475744; // "DWGR"
+    static constexpr std::uint32_t kFormatVersion = 9;
+
+    [[nodiscard]] static inline std::string encode(const Request &request) {
+        std::string buffer = {};
+        const auto writeInt = [&buffer]<typename T>(const T value) {
+            buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        };
+        const auto writeString = [&buffer, &writeInt](const std::string_view str) {
+            writeInt(std::uint32_t(str.size()));
+            buffer.append(str);
+        };
+        writeInt(kMagic);
+        writeInt(kFormatVersion);
+        const auto writeStrings = [&writeInt, &writeString](const std::stringlist &strs) {
+            writeInt(std::uint32_t(strs.size()));
+            for (auto &&str : std::as_const(strs)) {
+                writeString(str);
+            }
+        };
+        writeStrings(request.inputFiles);
+        writeStrings(request.consumerFiles);
+        writeString(request.libraryFile);
+        writeString(request.profileFile);
+        writeString(request.outputFile);
+        writeString(request.inlineHeaderFile);
+        writeString(request.depfile);
+        const GeneratorOptions &generatorOptions = request.generatorOptions;
+        writeString(generatorOptions.dllFileName);
+        writeInt(std::uint8_t(generatorOptions.sysDirOnly));
+        writeInt(std::uint8_t(generatorOptions.binding));
+        writeInt(std::uint8_t(generatorOptions.fallbackStubs));
+        writeInt(std::uint8_t(generatorOptions.instrument));
+        writeInt(std::uint8_t(generatorOptions.directLookup));
+        writeInt(std::uint8_t(generatorOptions.offsetCache));
+        writeInt(std::uint8_t(generatorOptions.preload));
+        writeInt(generatorOptions.pageTraceSeconds);
+        writeInt(std::uint8_t(generatorOptions.writeIfChanged));
+        writeString(generatorOptions.sourceDateEpoch);
+        const ParseOptions &parseOptions = request.parseOptions;
+        writeInt(std::uint64_t(parseOptions.threadCount));
+        writeString(parseOptions.cacheDirectory.string());
+        writeInt(std::uint8_t(parseOptions.umbrella));
+        writeString(parseOptions.compilationDatabase.string());
+        writeString(parseOptions.compileCommandsEntry);
+        writeString(parseOptions.prefixHeader);
+        return buffer;
+    }
+
+    [[nodiscard]] static inline bool decode(const std::string_view message, Request &requestOut) {
+        const char *cursor = message.data();
+        const char *const end = message.data() + message.size();
+        const auto readInt = [&cursor, end]<typename T>(T &valueOut) -> bool {
+            if (std::size_t(end - cursor) < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&valueOut, cursor, sizeof(T));
+            cursor += sizeof(T);
+            return true;
+        };
+        const auto readString = [&cursor, end, &readInt](std::string &strOut) -> bool {
+            std::uint32_t length = 0;
+            if (!readInt(length) || (std::size_t(end - cursor) < length)) {
+                return false;
+            }
+            strOut.assign(cursor, length);
+            cursor += length;
+            return true;
+        };
+        const auto readBool = [&readInt](bool &valueOut) -> bool {
+            std::uint8_t value = 0;
+            if (!readInt(value)) {
+                return false;
+            }
+            valueOut = (value != 0);
+            return true;
+        };
+        const auto readStrings = [&cursor, end, &readInt, &readString](std::stringlist &strsOut) -> bool {
+            std::uint32_t count = 0;
+            // Every string takes four bytes at least, don't let a broken count allocate gigabytes.
+            if (!readInt(count) || (count > (std::size_t(end - cursor) / sizeof(std::uint32_t)))) {
+                return false;
+            }
+            strsOut.resize(count);
+            for (auto &&str : strsOut) {
+                if (!readString(str)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        std::uint32_t magic = 0;
+        std::uint32_t formatVersion = 0;
+        if (!readInt(magic) || (magic != kMagic) || !readInt(formatVersion) || (formatVersion != kFormatVersion)) {
+            return false;
+        }
+        Request request = {};
+        if (!readStrings(request.inputFiles) || !readStrings(request.consumerFiles) || !readString(request.libraryFile) || !readString(request.profileFile)) {
+            return false;
+        }
+        GeneratorOptions &generatorOptions = request.generatorOptions;
+        ParseOptions &parseOptions = request.parseOptions;
+        std::uint8_t binding = 0;
+        std::uint64_t threadCount = 0;
+        std::string cacheDirectory = {};
+        std::string compilationDatabase = {};
+        if (!readString(request.outputFile) || !readString(request.inlineHeaderFile) || !readString(request.depfile)
+            || !readString(generatorOptions.dllFileName) || !readBool(generatorOptions.sysDirOnly) || !readInt(binding)
+            || !readBool(generatorOptions.fallbackStubs) || !readBool(generatorOptions.instrument) || !readBool(generatorOptions.directLookup) || !readBool(generatorOptions.offsetCache) || !readBool(generatorOptions.preload) || !readInt(generatorOptions.pageTraceSeconds) || !readBool(generatorOptions.writeIfChanged)
+            || !readString(generatorOptions.sourceDateEpoch)
+            || !readInt(threadCount) || !readString(cacheDirectory) || !readBool(parseOptions.umbrella) || !readString(compilationDatabase)
+            || !readString(parseOptions.compileCommandsEntry) || !readString(parseOptions.prefixHeader)) {
+            return false;
+        }
+        if (binding > std::uint8_t(BindingMode::IFunc)) {
+            return false;
+        }
+        generatorOptions.binding = BindingMode(binding);
+        parseOptions.threadCount = std::size_t(threadCount);
+        parseOptions.cacheDirectory = cacheDirectory;
+        parseOptions.compilationDatabase = compilationDatabase;
+        requestOut = std::move(request);
+        return true;
+    }
+};
+
+#ifndef WIN32
+// Every message on the socket is a u32 length followed by the bytes.
+[[nodiscard]] static inline bool sendMessage(const int fd, const std::string_view message)
+{
+#  ifdef MSG_NOSIGNAL
+    static constexpr const int kSendFlags = MSG_NOSIGNAL; // A client which went away must not kill the server.
+#  else
+    static constexpr const int kSendFlags = 0;
+#  endif
+    const auto length = std::uint32_t(message.size());
+    std::string buffer(reinterpret_cast<const char *>(&length), sizeof(length));
+    buffer.append(message);
+    for (std::size_t offset = 0; offset < buffer.size();) {
+        const ssize_t sent = ::send(fd, buffer.data() + offset, buffer.size() - offset, kSendFlags);
+        if (sent <= 0) {
+            if ((sent < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return false;
+        }
+        offset += std::size_t(sent);
+    }
+    return true;
+}
+
+// The length comes from the peer, a request is a few file names and options, anything larger is not one.
+[[nodiscard]] static inline bool receiveMessage(const int fd, std::string &messageOut)
+{
+    static constexpr const std::uint32_t kMaxMessageSize = 16 * 1024 * 1024;
+    const auto receive = [fd](char *data, const std::size_t size) -> bool {
+        for (std::size_t offset = 0; offset < size;) {
+            const ssize_t received = ::recv(fd, data + offset, size - offset, 0);
+            if (received <= 0) {
+                if ((received < 0) && (errno == EINTR)) {
+                    continue;
+                }
+                return false;
+            }
+            offset += std::size_t(received);
+        }
+        return true;
+    };
+    std::uint32_t length = 0;
+    if (!receive(reinterpret_cast<char *>(&length), sizeof(length)) || (length > kMaxMessageSize)) {
+        return false;
+    }
+    std::string message(length, '\0');
+    if (!receive(message.data(), message.size())) {
+        return false;
+    }
+    messageOut = std::move(message);
+    return true;
+}
+
+[[nodiscard]] static inline bool toSocketAddress(const std::string_view path, sockaddr_un &addressOut)
+{
+    addressOut = {};
+    addressOut.sun_family = AF_UNIX;
+    if (path.empty() || (path.size() >= sizeof(addressOut.sun_path))) {
+        std::cerr << "The socket path is empty or too long:" << path << std::endl;
+        return false;
+    }
+    std::memcpy(addressOut.sun_path, path.data(), path.size());
+    return true;
+}
+
+// Tells whether a server accepts connections on the socket.
+[[nodiscard]] static inline bool isSocketInUse(const sockaddr_un &address)
+{
+    const int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client < 0) {
+        return false;
+    }
+    const bool connected = (::connect(client, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0);
+    ::close(client);
+    return connected;
+}
+#endif
+
+// Serves the requests of the clients, one connection carries one request and its reply (a u32 exit code).
+// The requests are handled concurrently on "threadCount" threads, and the libclang indexes and the parsed
+// headers are kept in memory for the whole lifetime of the server, so the headers which several requests
+// share are only parsed once. The diagnostics of the requests go to the output of the server.
+[[nodiscard]] static inline bool runServer(const std::string_view socketPath, const std::size_t threadCount)
+{
+#ifdef WIN32
+    static_cast<void>(socketPath);
+    static_cast<void>(threadCount);
+    std::cerr << "The server mode is not available on Windows." << std::endl;
+    return false;
+#else
+    sockaddr_un address = {};
+    if (!toSocketAddress(socketPath, address)) {
+        return false;
+    }
+    const int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        std::cerr << "Failed to create the server socket." << std::endl;
+        return false;
+    }
+    ::fcntl(server, F_SETFD, FD_CLOEXEC);
+    // A server which didn't exit cleanly leaves its socket file behind. Only a socket which nobody listens on
+    // anymore is removed, never a file which happens to have the same name, nor the socket of a running server.
+    struct stat status = {};
+    if (::lstat(address.sun_path, &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            std::cerr << "The socket path exists and it's not a socket:" << socketPath << std::endl;
+            ::close(server);
+            return false;
+        }
+        if (isSocketInUse(address)) {
+            std::cerr << "Another server is already listening on:" << socketPath << std::endl;
+            ::close(server);
+            return false;
+        }
+        ::unlink(address.sun_path);
+    }
+    if ((::bind(server, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) || (::listen(server, SOMAXCONN) != 0)) {
+        std::cerr << "Failed to listen on:" << socketPath << std::endl;
+        ::close(server);
+        return false;
+    }
+    IndexPool indexPool = {};
+    SharedHeaderCache sharedCache = {};
+    std::mutex mutex = {};
+    std::condition_variable condition = {};
+    std::deque<int> clients = {};
+    const auto serve = [&indexPool, &sharedCache](const int client) {
+        std::string message = {};
+        Request request = {};
+        std::uint32_t exitCode = EXIT_FAILURE;
+        if (receiveMessage(client, message) && RequestCodec::decode(message, request)) {
+            request.parseOptions.indexPool = &indexPool;
+            request.parseOptions.sharedCache = &sharedCache;
+            std::cout << "Generating " << request.outputFile << " for a client." << std::endl;
+            if (runRequest(request)) {
+                exitCode = EXIT_SUCCESS;
+            }
+            std::cout << "Shared header cache: " << sharedCache.hits() << " hit(s), " << sharedCache.failures() << " failed parse(s) so far." << std::endl;
+        } else {
+            std::cerr << "Received an invalid request." << std::endl;
+        }
+        static_cast<void>(sendMessage(client, std::string_view(reinterpret_cast<const char *>(&exitCode), sizeof(exitCode))));
+        ::close(client);
+    };
+    std::vector<std::thread> workers = {};
+    const std::size_t workerCount = std::max(threadCount, std::size_t(1));
+    workers.reserve(workerCount);
+    for (std::size_t worker = 0; worker != workerCount; ++worker) {
+        workers.emplace_back([&mutex, &condition, &clients, &serve]() {
+            while (true) {
+                int client = -1;
+                {
+                    std::unique_lock locker(mutex);
+                    condition.wait(locker, [&clients]() -> bool { return !clients.empty(); });
+                    client = clients.front();
+                    clients.pop_front();
+                }
+                if (client < 0) {
+                    return;
+                }
+                serve(client);
+            }
+        });
+    }
+    std::cout << "Listening on " << socketPath << " with " << workerCount << " thread(s), press Ctrl+C to quit." << std::endl;
+    bool succeeded = true;
+    while (true) {
+        const int client = ::accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED)) {
+                continue;
             }
-            out << std::endl;
-            out << '}' << std::endl;
+            std::cerr << "Failed to accept the connection of a client." << std::endl;
+            succeeded = false;
+            break;
+        }
+        ::fcntl(client, F_SETFD, FD_CLOEXEC);
+        {
+            const std::scoped_lock locker(mutex);
+            clients.push_back(client);
+        }
+        condition.notify_one();
+    }
+    // A negative descriptor tells a worker to quit.
+    {
+        const std::scoped_lock locker(mutex);
+        clients.insert(clients.end(), workerCount, -1);
+    }
+    condition.notify_all();
+    for (auto &&worker : workers) {
+        worker.join();
+    }
+    ::close(server);
+    ::unlink(address.sun_path);
+    return succeeded;
+#endif
+}
+
+// Sends the request to a server and waits for its exit code. Returns false if there's no server to talk to,
+// the caller can still do the work itself then.
+[[nodiscard]] static inline bool forwardRequest(const std::string_view socketPath, const Request &request, int &exitCodeOut)
+{
+#ifdef WIN32
+    static_cast<void>(socketPath);
+    static_cast<void>(request);
+    static_cast<void>(exitCodeOut);
+    return false;
+#else
+    sockaddr_un address = {};
+    if (!toSocketAddress(socketPath, address)) {
+        return false;
+    }
+    // The server has its own working directory.
+    Request absoluteRequest = request;
+    for (auto &&inputFile : absoluteRequest.inputFiles) {
+        inputFile = toAbsolutePath(inputFile);
+    }
+    for (auto &&consumerFile : absoluteRequest.consumerFiles) {
+        consumerFile = toAbsolutePath(consumerFile);
+    }
+    absoluteRequest.outputFile = toAbsolutePath(absoluteRequest.outputFile);
+    ParseOptions &parseOptions = absoluteRequest.parseOptions;
+    for (std::string *path : { &absoluteRequest.libraryFile, &absoluteRequest.profileFile, &absoluteRequest.inlineHeaderFile, &absoluteRequest.depfile, &parseOptions.compileCommandsEntry, &parseOptions.prefixHeader }) {
+        if (!path->empty()) {
+            *path = toAbsolutePath(*path);
+        }
+    }
+    for (std::filesystem::path *path : { &parseOptions.cacheDirectory, &parseOptions.compilationDatabase }) {
+        if (!path->empty()) {
+            *path = toAbsolutePath(path->string());
         }
     }
-    out << "#endif" << std::endl;
-    out << "// WRAPPED FUNCTION COUNT: " << totalFunctionCount << std::endl;
-    out.close();
-    std::cout << "The wrapper source is successfully generated." << std::endl;
+    const int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client < 0) {
+        return false;
+    }
+    if (::connect(client, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(client);
+        return false;
+    }
+    std::string reply = {};
+    const bool succeeded = sendMessage(client, RequestCodec::encode(absoluteRequest)) && receiveMessage(client, reply) && (reply.size() == sizeof(std::uint32_t));
+    ::close(client);
+    if (!succeeded) {
+        return false;
+    }
+    std::uint32_t exitCode = EXIT_FAILURE;
+    std::memcpy(&exitCode, reply.data(), sizeof(exitCode));
+    exitCodeOut = int(exitCode);
     return true;
+#endif
 }
 
 } // namespace DWG
@@ -409,28 +4725,138 @@ main(int, char **)
     inputArgument.setDisplayName("<header files>");
     inputArgument.setMultiValueEnabled(true);
     SysCmdLine::Option inputOption({ "--input", "/input" }, "Header files to parse.");
-    inputOption.setRequired(true);
     //inputOption.setUnlimitedOccurrence();
     inputOption.addArgument(inputArgument);
     SysCmdLine::Argument outputArgument("output-file");
     outputArgument.setDisplayName("<source file>");
     SysCmdLine::Option outputOption({ "--output", "/output" }, "The wrapper source file to generate.");
-    outputOption.setRequired(true);
     outputOption.addArgument(outputArgument);
+    SysCmdLine::Argument inlineHeaderArgument("inline-header");
+    inlineHeaderArgument.setDisplayName("<header file>");
+    SysCmdLine::Option inlineHeaderOption({ "--inline-header", "/inline-header" }, "Also generate a header of inline accessors (in the DWG_<DLL name> namespace) which call through the symbol table right at the call site, without the wrapper in between (table binding mode only).");
+    inlineHeaderOption.addArgument(inlineHeaderArgument);
     SysCmdLine::Argument dllFileNameArgument("dll-filename");
     dllFileNameArgument.setDisplayName("<DLL file name>");
     SysCmdLine::Option dllFileNameOption({ "--dll", "/dll" }, "The DLL file name to load.");
-    dllFileNameOption.setRequired(true);
     dllFileNameOption.addArgument(dllFileNameArgument);
     const SysCmdLine::Option sysDirOnlyOption({ "--sys-dir-only", "/sys-dir-only" }, "Only load DLL from the system directory.");
+    SysCmdLine::Argument jobsArgument("job-count");
+    jobsArgument.setDisplayName("<N>");
+    SysCmdLine::Option jobsOption({ "--jobs", "/jobs" }, "Parse the header files with N threads (0 means one thread per CPU core, default is 1).");
+    jobsOption.addArgument(jobsArgument);
+    SysCmdLine::Argument maxRssArgument("max-rss");
+    maxRssArgument.setDisplayName("<MiB>");
+    SysCmdLine::Option maxRssOption({ "--max-rss", "/max-rss" }, "Report the peak memory usage of every phase and fail once it exceeds the given limit (0 means report only).");
+    maxRssOption.addArgument(maxRssArgument);
+    SysCmdLine::Argument cacheDirArgument("cache-dir");
+    cacheDirArgument.setDisplayName("<directory>");
+    SysCmdLine::Option cacheDirOption({ "--cache-dir", "/cache-dir" }, "Cache the parsed functions of every header in this directory and reuse them when the header is unchanged.");
+    cacheDirOption.addArgument(cacheDirArgument);
+    SysCmdLine::Argument compileCommandsArgument("compile-commands");
+    compileCommandsArgument.setDisplayName("<directory>");
+    SysCmdLine::Option compileCommandsOption({ "--compile-commands", "/compile-commands" }, "Parse every header file with the flags of its entry in the compile_commands.json of this directory.");
+    compileCommandsOption.addArgument(compileCommandsArgument);
+    SysCmdLine::Argument compileCommandsEntryArgument("compile-commands-entry");
+    compileCommandsEntryArgument.setDisplayName("<source file>");
+    SysCmdLine::Option compileCommandsEntryOption({ "--compile-commands-entry", "/compile-commands-entry" }, "The compilation database entry whose flags are used for the header files which don't have their own entry.");
+    compileCommandsEntryOption.addArgument(compileCommandsEntryArgument);
+    SysCmdLine::Argument prefixHeaderArgument("prefix-header");
+    prefixHeaderArgument.setDisplayName("<header file>");
+    SysCmdLine::Option prefixHeaderOption({ "--prefix-header", "/prefix-header" }, "Precompile this header once and include it before every header file, it's kept in the cache directory if there's one.");
+    prefixHeaderOption.addArgument(prefixHeaderArgument);
+    SysCmdLine::Argument bindingArgument("binding");
+    bindingArgument.setDisplayName("<lazy|table|thunk|ifunc>");
+    SysCmdLine::Option bindingOption({ "--binding", "/binding" }, "How the wrappers resolve their symbols: \"lazy\" (default) resolves every symbol on its first call, \"table\" resolves all of them at once into one table at startup, \"thunk\" is like \"table\" but uses assembly stubs on x86-64 and AArch64 Linux, which also wrap the variadic functions, \"ifunc\" lets the dynamic linker bind the wrappers to the real functions at load time (in GNU/Linux executables, the other builds get lazy wrappers). glibc can't load a library at that time, so only the functions of a library which is already loaded (e.g. a dependency of the program) are bound directly, the others get lazy wrappers, or stubs which return the default value if they're variadic.");
+    bindingOption.addArgument(bindingArgument);
+    const SysCmdLine::Option fallbackStubsOption({ "--fallback-stubs", "/fallback-stubs" }, "Point the table slots of the missing symbols to stubs which return the default value, so that the wrappers don't need to check for null (table binding mode only).");
+    const SysCmdLine::Option directLookupOption({ "--direct-lookup", "/direct-lookup" }, "Resolve the symbol table through the GNU hash table of the loaded library in one pass instead of calling dlsym() for every symbol (table and thunk binding modes only, ELF platforms only, the others keep using dlsym()).");
+    const SysCmdLine::Option offsetCacheOption({ "--offset-cache", "/offset-cache" }, "Implies --direct-lookup, and keeps the resolved symbol offsets in a file keyed by the build-id of the library ($DWG_OFFSET_CACHE_DIR, $XDG_CACHE_HOME/dwg or ~/.cache/dwg), so that the later startups don't look up any symbol by its name.");
+    const SysCmdLine::Option preloadOption({ "--preload", "/preload" }, "Load the library (and resolve the symbol table) on a background thread started at static initialization time of an executable or by DWG_Preload() (define DWG_NO_AUTO_PRELOAD to only start it explicitly, a shared library must call it outside of the loader lock, i.e. not from its static initializers or DllMain), the wrappers called earlier wait for it (lazy and table binding modes only).");
+    SysCmdLine::Argument pageTraceArgument("seconds");
+    pageTraceArgument.setDisplayName("<seconds>");
+    SysCmdLine::Option pageTraceOption({ "--page-trace", "/page-trace" }, "Implies --preload, the first run of every build of the library records the pages of the functions it calls in the given number of seconds ($DWG_PAGE_TRACE_DIR, $XDG_CACHE_HOME/dwg or ~/.cache/dwg), and the later runs prefetch only those pages instead of reading the whole library ahead (ELF platforms only).");
+    pageTraceOption.addArgument(pageTraceArgument);
+    const SysCmdLine::Option instrumentOption({ "--instrument", "/instrument" }, "Count the calls and record the latency histogram of every wrapper, the statistics are written by DWG_DumpStats() (not available in the thunk and ifunc binding modes).");
+    SysCmdLine::Argument depfileArgument("depfile");
+    depfileArgument.setDisplayName("<depfile>");
+    SysCmdLine::Option depfileOption({ "--depfile", "/depfile" }, "Write a Make/Ninja compatible depfile, which lists every file read while parsing the header files.");
+    depfileOption.addArgument(depfileArgument);
+    SysCmdLine::Argument usedByArgument("consumer-files");
+    usedByArgument.setDisplayName("<object files>");
+    usedByArgument.setMultiValueEnabled(true);
+    SysCmdLine::Option usedByOption({ "--used-by", "/used-by" }, "Only wrap the functions which these ELF object files, static archives or linked binaries reference.");
+    usedByOption.addArgument(usedByArgument);
+    SysCmdLine::Argument profileArgument("profile");
+    profileArgument.setDisplayName("<profile>");
+    SysCmdLine::Option profileOption({ "--profile", "/profile" }, "Lay the wrappers and their table slots out by the call counts DWG_DumpStats() of an instrumented wrapper wrote (either format), the hottest first, and mark the hot ones [[gnu::hot]] and the never called ones [[gnu::cold]].");
+    profileOption.addArgument(profileArgument);
+    SysCmdLine::Argument libraryFileArgument("library-file");
+    libraryFileArgument.setDisplayName("<shared library>");
+    SysCmdLine::Option libraryFileOption({ "--library-file", "/library-file" }, "Read the export table of this ELF shared library (it's not loaded), skip the functions it doesn't export and list the mismatches at the end of the wrapper source.");
+    libraryFileOption.addArgument(libraryFileArgument);
+    const SysCmdLine::Option writeIfChangedOption({ "--write-if-changed", "/write-if-changed" }, "Don't touch the output file if its content (ignoring the generation time) didn't change. Set SOURCE_DATE_EPOCH to make the generation time reproducible as well.");
+    const SysCmdLine::Option watchOption({ "--watch", "/watch" }, "Stay resident and regenerate the wrapper source whenever a header file (or anything it includes) changes, only the changed header files are parsed again.");
+    SysCmdLine::Argument serverArgument("server-socket");
+    serverArgument.setDisplayName("<socket path>");
+    SysCmdLine::Option serverOption({ "--server", "/server" }, "Stay resident and serve the requests of the clients on this Unix domain socket, the headers which several requests share are only parsed once (--jobs sets how many requests are served at the same time).");
+    serverOption.addArgument(serverArgument);
+    SysCmdLine::Argument connectArgument("connect-socket");
+    connectArgument.setDisplayName("<socket path>");
+    SysCmdLine::Option connectOption({ "--connect", "/connect" }, "Let the server listening on this Unix domain socket do the work, falls back to doing it locally if there's no server.");
+    connectOption.addArgument(connectArgument);
+    const SysCmdLine::Option umbrellaOption({ "--umbrella", "/umbrella" }, "Parse all the header files in one translation unit, so that their common includes are only parsed once.");
     SysCmdLine::Command rootCommand(SysCmdLine::appName(), "A convenient tool to generate a wrapper layer for DLLs.");
     rootCommand.addVersionOption("1.0.0.0");
     rootCommand.addHelpOption(true, true);
     rootCommand.addOption(inputOption);
     rootCommand.addOption(outputOption);
+    rootCommand.addOption(inlineHeaderOption);
     rootCommand.addOption(dllFileNameOption);
     rootCommand.addOption(sysDirOnlyOption);
+    rootCommand.addOption(jobsOption);
+    rootCommand.addOption(maxRssOption);
+    rootCommand.addOption(cacheDirOption);
+    rootCommand.addOption(umbrellaOption);
+    rootCommand.addOption(compileCommandsOption);
+    rootCommand.addOption(compileCommandsEntryOption);
+    rootCommand.addOption(prefixHeaderOption);
+    rootCommand.addOption(bindingOption);
+    rootCommand.addOption(fallbackStubsOption);
+    rootCommand.addOption(directLookupOption);
+    rootCommand.addOption(offsetCacheOption);
+    rootCommand.addOption(preloadOption);
+    rootCommand.addOption(pageTraceOption);
+    rootCommand.addOption(instrumentOption);
+    rootCommand.addOption(usedByOption);
+    rootCommand.addOption(libraryFileOption);
+    rootCommand.addOption(profileOption);
+    rootCommand.addOption(writeIfChangedOption);
+    rootCommand.addOption(depfileOption);
+    rootCommand.addOption(watchOption);
+    rootCommand.addOption(serverOption);
+    rootCommand.addOption(connectOption);
     rootCommand.setHandler([&](const SysCmdLine::ParseResult &result) -> int {
+        DWG::Request request = {};
+        DWG::GeneratorOptions &generatorOptions = request.generatorOptions;
+        DWG::ParseOptions &parseOptions = request.parseOptions;
+        if (result.optionIsSet(jobsOption)) {
+            if (!DWG::toUnsigned(result.valueForOption(jobsOption).toString(), parseOptions.threadCount)) {
+                std::cerr << "You need to specify a valid job count (a non-negative integer)." << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (parseOptions.threadCount == 0) {
+                parseOptions.threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+        }
+        if (result.optionIsSet(serverOption)) {
+            const SysCmdLine::Value socketPath = result.valueForOption(serverOption);
+            if (socketPath.isEmpty()) {
+                std::cerr << "You need to specify a valid socket path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            // Everything else comes with the requests.
+            return DWG::runServer(socketPath.toString(), parseOptions.threadCount) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
         const std::vector<SysCmdLine::Value> inputFiles = result.option(inputOption).allValues();
         const SysCmdLine::Value outputFile = result.valueForOption(outputOption);
         const SysCmdLine::Value dllFileName = result.valueForOption(dllFileNameOption);
@@ -446,27 +4872,169 @@ main(int, char **)
             std::cerr << "You need to specify a valid DLL file name (better to include the file extension name as well)." << std::endl;
             return EXIT_FAILURE;
         }
-        const bool sysDirOnly = result.optionIsSet(sysDirOnlyOption);
-        DWG::Headers headers = {};
-        for (auto &&inputFile : std::as_const(inputFiles)) {
-            const std::string filePath = inputFile.toString();
-            DWG::Functions functions = {};
-            if (!DWG::parseTranslationUnit(filePath, functions) || functions.empty()) {
+        generatorOptions.dllFileName = DWG::extractDllFileBaseName(dllFileName.toString());
+        generatorOptions.sysDirOnly = result.optionIsSet(sysDirOnlyOption);
+        if (result.optionIsSet(bindingOption)) {
+            if (!DWG::toBindingMode(result.valueForOption(bindingOption).toString(), generatorOptions.binding)) {
+                std::cerr << "You need to specify a valid binding mode (\"lazy\", \"table\", \"thunk\" or \"ifunc\")." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        generatorOptions.fallbackStubs = result.optionIsSet(fallbackStubsOption);
+        if (generatorOptions.fallbackStubs && (generatorOptions.binding != DWG::BindingMode::Table)) {
+            std::cerr << "The fallback stubs are only available in the table binding mode." << std::endl;
+            return EXIT_FAILURE;
+        }
+        generatorOptions.offsetCache = result.optionIsSet(offsetCacheOption);
+        generatorOptions.directLookup = result.optionIsSet(directLookupOption) || generatorOptions.offsetCache;
+        if (generatorOptions.directLookup && !DWG::usesSymbolTable(generatorOptions.binding)) {
+            std::cerr << "The direct lookup is only available in the table and thunk binding modes." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (result.optionIsSet(pageTraceOption)) {
+            if (!DWG::toUnsigned(result.valueForOption(pageTraceOption).toString(), generatorOptions.pageTraceSeconds) || (generatorOptions.pageTraceSeconds == 0)) {
+                std::cerr << "You need to specify a valid page trace duration (a positive integer, in seconds)." << std::endl;
                 return EXIT_FAILURE;
             }
-            DWG::Header header = {};
-            header.filename = DWG::extractFileName(filePath);
-            header.functions = functions;
-            headers.push_back(header);
         }
-        if (headers.empty()) {
+        generatorOptions.preload = result.optionIsSet(preloadOption) || (generatorOptions.pageTraceSeconds > 0);
+        if (generatorOptions.preload && !DWG::hasWrapperFrame(generatorOptions.binding)) {
+            std::cerr << "The thunks and the ifuncs have no wrapper frame to wait for the preloaded library in." << std::endl;
             return EXIT_FAILURE;
         }
-        const std::string dllFileBaseName = DWG::extractDllFileBaseName(dllFileName.toString());
-        if (!DWG::generateWrapper(outputFile.toString(), dllFileBaseName, sysDirOnly, headers)) {
+        generatorOptions.instrument = result.optionIsSet(instrumentOption);
+        if (generatorOptions.instrument && !DWG::hasWrapperFrame(generatorOptions.binding)) {
+            std::cerr << "The thunks and the ifuncs have no wrapper frame to instrument." << std::endl;
             return EXIT_FAILURE;
         }
-        return EXIT_SUCCESS;
+        if (result.optionIsSet(inlineHeaderOption)) {
+            const SysCmdLine::Value inlineHeaderFile = result.valueForOption(inlineHeaderOption);
+            if (inlineHeaderFile.isEmpty()) {
+                std::cerr << "You need to specify a valid inline header path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (generatorOptions.binding != DWG::BindingMode::Table) {
+                std::cerr << "The inline accessors are only available in the table binding mode." << std::endl;
+                return EXIT_FAILURE;
+            }
+            // Everything which needs the wrapper frame would be skipped by the calls which don't go through it.
+            if (generatorOptions.preload || generatorOptions.instrument) {
+                std::cerr << "The inline accessors bypass the wrappers, they can't wait for the preloaded library or be instrumented." << std::endl;
+                return EXIT_FAILURE;
+            }
+            request.inlineHeaderFile = inlineHeaderFile.toString();
+        }
+        generatorOptions.writeIfChanged = result.optionIsSet(writeIfChangedOption);
+        if (const char *sourceDateEpoch = std::getenv("SOURCE_DATE_EPOCH")) {
+            generatorOptions.sourceDateEpoch = sourceDateEpoch;
+        }
+        DWG::MemoryGuard &memoryGuard = parseOptions.memoryGuard;
+        if (result.optionIsSet(maxRssOption)) {
+            if (!DWG::toUnsigned(result.valueForOption(maxRssOption).toString(), memoryGuard.limit)) {
+                std::cerr << "You need to specify a valid memory limit (a non-negative integer, in MiB)." << std::endl;
+                return EXIT_FAILURE;
+            }
+            memoryGuard.enabled = true;
+        }
+        if (result.optionIsSet(cacheDirOption)) {
+            const SysCmdLine::Value cacheDir = result.valueForOption(cacheDirOption);
+            if (cacheDir.isEmpty()) {
+                std::cerr << "You need to specify a valid cache directory." << std::endl;
+                return EXIT_FAILURE;
+            }
+            parseOptions.cacheDirectory = cacheDir.toString();
+        }
+        parseOptions.umbrella = result.optionIsSet(umbrellaOption);
+        if (result.optionIsSet(compileCommandsOption)) {
+            const SysCmdLine::Value compileCommands = result.valueForOption(compileCommandsOption);
+            if (compileCommands.isEmpty()) {
+                std::cerr << "You need to specify a valid directory which contains compile_commands.json." << std::endl;
+                return EXIT_FAILURE;
+            }
+            parseOptions.compilationDatabase = compileCommands.toString();
+        }
+        if (result.optionIsSet(compileCommandsEntryOption)) {
+            if (parseOptions.compilationDatabase.empty()) {
+                std::cerr << "The compilation database entry needs a compilation database (--compile-commands)." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const SysCmdLine::Value compileCommandsEntry = result.valueForOption(compileCommandsEntryOption);
+            if (compileCommandsEntry.isEmpty()) {
+                std::cerr << "You need to specify a valid compilation database entry." << std::endl;
+                return EXIT_FAILURE;
+            }
+            parseOptions.compileCommandsEntry = compileCommandsEntry.toString();
+        }
+        if (result.optionIsSet(prefixHeaderOption)) {
+            const SysCmdLine::Value prefixHeader = result.valueForOption(prefixHeaderOption);
+            if (prefixHeader.isEmpty()) {
+                std::cerr << "You need to specify a valid prefix header file path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            parseOptions.prefixHeader = prefixHeader.toString();
+        }
+        request.inputFiles.reserve(inputFiles.size());
+        for (auto &&inputFile : std::as_const(inputFiles)) {
+            request.inputFiles.push_back(inputFile.toString());
+        }
+        request.outputFile = outputFile.toString();
+        if (result.optionIsSet(libraryFileOption)) {
+            const SysCmdLine::Value libraryFile = result.valueForOption(libraryFileOption);
+            if (libraryFile.isEmpty()) {
+                std::cerr << "You need to specify a valid library file path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            request.libraryFile = libraryFile.toString();
+        }
+        if (result.optionIsSet(profileOption)) {
+            const SysCmdLine::Value profileFile = result.valueForOption(profileOption);
+            if (profileFile.isEmpty()) {
+                std::cerr << "You need to specify a valid profile path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            request.profileFile = profileFile.toString();
+        }
+        if (result.optionIsSet(usedByOption)) {
+            for (auto &&consumerFile : result.option(usedByOption).allValues()) {
+                if (consumerFile.isEmpty()) {
+                    std::cerr << "You need to specify valid consumer file paths." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                request.consumerFiles.push_back(consumerFile.toString());
+            }
+        }
+        if (result.optionIsSet(depfileOption)) {
+            const SysCmdLine::Value depfile = result.valueForOption(depfileOption);
+            if (depfile.isEmpty()) {
+                std::cerr << "You need to specify a valid depfile path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            request.depfile = depfile.toString();
+        }
+        if (result.optionIsSet(watchOption)) {
+            if (parseOptions.umbrella) {
+                std::cerr << "The watch mode keeps one translation unit for every header file, it can't be used together with the umbrella mode." << std::endl;
+                return EXIT_FAILURE;
+            }
+            // Only the changed headers are parsed again, so there's nothing for the cache to save.
+            parseOptions.cacheDirectory.clear();
+            generatorOptions.writeIfChanged = true;
+            const auto generate = [&request](const DWG::Headers &parsedHeaders) -> bool { return DWG::generateOutputs(request, parsedHeaders); };
+            return DWG::watchHeaders(request.inputFiles, parseOptions, generate) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (result.optionIsSet(connectOption)) {
+            const SysCmdLine::Value socketPath = result.valueForOption(connectOption);
+            if (socketPath.isEmpty()) {
+                std::cerr << "You need to specify a valid socket path." << std::endl;
+                return EXIT_FAILURE;
+            }
+            int exitCode = EXIT_FAILURE;
+            if (DWG::forwardRequest(socketPath.toString(), request, exitCode)) {
+                return exitCode;
+            }
+            std::cout << "No server is listening on " << socketPath.toString() << ", generating locally." << std::endl;
+        }
+        return DWG::runRequest(request) ? EXIT_SUCCESS : EXIT_FAILURE;
     });
     SYSCMDLINE_ASSERT_COMMAND(rootCommand);
     SysCmdLine::Parser parser(rootCommand);